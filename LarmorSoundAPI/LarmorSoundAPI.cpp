@@ -28,18 +28,238 @@
 
 // LarmorSound API header
 #include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_WorkerPool.h"
+#include "LarmorSoundAPI_BlockRing.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+#include "LarmorSoundAPI_Cache.h"
+#include "LarmorSoundAPI_SIMD.h"
+#include "LarmorSoundAPI_Quantizer.h"
+#include "LarmorSoundAPI_SPSCQueue.h"
+#include "LarmorSoundAPI_Mixer.h"
+#include "LarmorSoundAPI_Async.h"
+#include "LarmorSoundAPI_Lazy.h"
+#include "LarmorSoundAPI_MappedFile.h"
+#include "LarmorSoundAPI_AssetCache.h"
+#include "LarmorSoundAPI_AubioState.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
 
 namespace Larmor {
 
+    // Analysis cache configuration, shared by all the LarmorSound objects
+    static std::mutex cacheConfigMutex;
+    static bool cacheActive = false;
+    static std::string cacheDirectory;
+
+    // Directory of the files of the mapped storage, shared by all the LarmorSound objects
+    static std::mutex storageConfigMutex;
+    static std::string mappedStorageDirectory;
+
+    // Software mixer shared by the objects played with initMixerPlay
+    static std::mutex mixerMutex;
+    static AudioMixer *sharedMixer = NULL;
+
+    // New arena in the heap, or with mapped in files of the mapped storage directory.
+    //  If the files can not be created the arena stays in the heap
+    template <typename T>
+    static ChannelArena<T> *newArena(uint8_t numChannels, uint32_t rowSize, bool mapped)
+    {
+        ChannelArena<T> *arena = new ChannelArena<T>(numChannels, rowSize);
+        if (mapped) {
+            std::string directory;
+            {
+                std::lock_guard<std::mutex> lock(storageConfigMutex);
+                directory = mappedStorageDirectory;
+            }
+            if (!arena->setMapped(directory)) {
+                std::cout << "LarmorSound:: error creating the mapped storage files in "
+                    << (directory.empty() ? "the temporary directory" : directory)
+                    << ", the memory is used" << std::endl;
+            }
+        }
+        return arena;
+    }
+
+    // The SIMD kernels and the client header work on float samples
+    static_assert(sizeof(smpl_t) == sizeof(float), "LarmorSound API requires aubio compiled with float samples");
+
+    // Playback command from the API threads to the audio callback
+    enum PlaybackCommandType
+    {
+        PLAYBACK_COMMAND_PLAY = 0,
+        PLAYBACK_COMMAND_STOP = 1
+    };
+
+    struct PlaybackCommand
+    {
+        uint8_t type;           // PlaybackCommandType
+        uint32_t position;      // play start position or PLAYBACK_POSITION_CURRENT
+    };
+
+    typedef std::chrono::steady_clock stage_clock;
+
+    static double elapsedSeconds(const stage_clock::time_point &start)
+    {
+        return std::chrono::duration<double>(stage_clock::now() - start).count();
+    }
+
+    // Name of the window in aubio new_aubio_window
+    static const char *aubioWindowName(WindowType window)
+    {
+        switch (window)
+        {
+            case WINDOW_HANN:
+                return "hanning";
+            case WINDOW_HAMMING:
+                return "hamming";
+            case WINDOW_BLACKMAN:
+                return "blackman";
+            default:
+                return "rectangle";
+        }
+    }
+
+    static spectrum_kernel selectSpectrumKernel(SpectrumMode mode)
+    {
+        const SpectrumKernels &kernels = getSpectrumKernels();
+        switch (mode)
+        {
+            case SPECTRUM_POWER:
+                return kernels.power;
+            case SPECTRUM_DB:
+                return kernels.decibel;
+            default:
+                return kernels.magnitude;
+        }
+    }
+
+    static AnalysisOptions threadsOptions(uint32_t numThreads)
+    {
+        AnalysisOptions options;
+        options.numThreads = numThreads;
+        return options;
+    }
+
+    // Stores decoded samples in the arena element type
+    static void storeSamples(const smpl_t *in, uint32_t length, smpl_t *out)
+    {
+        std::copy(in, in + length, out);
+    }
+
+    static void storeSamples(const smpl_t *in, uint32_t length, int16_t *out)
+    {
+        getPcmKernels().encode(in, out, length);
+    }
+
+    // Sample of the file at seconds, for the partial loading range
+    static uint32_t rangeSampleOffset(double seconds, uint32_t samplerate)
+    {
+        return (uint32_t)std::min(seconds * samplerate + 0.5, (double)UINT32_MAX);
+    }
+
+    // Reads the next block of the source, at most remaining samples of it are used
+    static uint32_t readSource(aubio_source_t *source, fmat_t *mat_in, uint32_t remaining)
+    {
+        uint32_t read = 0;
+        aubio_source_do_multi(source, mat_in, &read);
+        return std::min(read, remaining);
+    }
+
+    // Appends the read samples of the loaded channels of mat_in to samples, growing it
+    //  geometrically: the channel c of samples is the channel sourceChannels[c] of mat_in.
+    //  False if the storage can not grow (out of memory, or of disk for the mapped storage)
+    template <typename T>
+    static bool appendSamples(ChannelArena<T> &samples, const fmat_t *mat_in,
+        const std::vector<uint8_t> &sourceChannels, uint32_t read)
+    {
+        uint32_t stored = samples.getNumRows();
+        if (samples.getCapacityRows() < stored + read) {
+            samples.reserve(std::max(samples.getCapacityRows() / 2 * 3, stored + SAMPLES_GROWTH_CHUNK));
+        }
+        if (!samples.resize(stored + read)) {
+            return false;
+        }
+        for (uint8_t channel = 0; channel < samples.getNumChannels(); channel++)
+        {
+            storeSamples(mat_in->data[sourceChannels[channel]], read, samples.row(channel, stored));
+        }
+        return true;
+    }
+
+    // Reads the source samples, up to rangeSamples, in samples (growing it as the decode stage
+    //  does), the lazy analysis reads no frame. Returns the samples read, storageFailed is set
+    //  if the samples can not be stored
+    template <typename T>
+    static uint32_t decodeSamples(aubio_source_t *source, fmat_t *mat_in, uint32_t hop_s,
+        const std::vector<uint8_t> &sourceChannels, uint32_t rangeSamples, ChannelArena<T> &samples,
+        LoadProgress *progress, bool &cancelled, bool &storageFailed)
+    {
+        uint32_t total_read = 0;
+        uint32_t read = 0;
+        do
+        {
+            read = readSource(source, mat_in, rangeSamples - total_read);
+            if (!appendSamples(samples, mat_in, sourceChannels, read)) {
+                storageFailed = true;
+                break;
+            }
+            total_read += read;
+            if (progress != NULL) {
+                progress->blocksDone = total_read / hop_s;
+                cancelled = progress->cancelRequested;
+            }
+        } while (read == mat_in->length && total_read < rangeSamples && !cancelled);
+        return total_read;
+    }
+
+    static void deleteFFTWorkers(std::vector<aubio_fft_t *> &ffts, std::vector<cvec_t *> &fftgrains)
+    {
+        for (size_t w = 0; w < ffts.size(); w++)
+        {
+            if (ffts[w] != NULL) {
+                AubioState::deleteFFT(ffts[w]);
+            }
+            del_cvec(fftgrains[w]);
+        }
+    }
+
     // Constructor
     //  Takes the file audio filename and read all the audio channels in memory and 
     //  computes the FFT for all the tracks, populating the private class members
-    LarmorSound::LarmorSound(const char *filename) : initedCreation(false)
+    //  numThreads is the number of threads used for the FFT, 0 means one per hardware core
+    LarmorSound::LarmorSound(const char *filename, uint32_t numThreads) :
+        LarmorSound(filename, threadsOptions(numThreads))
+    {
+    }
+
+    // Constructor
+    //  As above, with the STFT parameters of options: the frame k of the spectrum is the
+    //  windowed FFT of the fftSize samples starting at k * hopSize
+    LarmorSound::LarmorSound(const char *filename, const AnalysisOptions &options) :
+        LarmorSound(options, NULL)
+    {
+        load(filename);
+    }
+
+    // Constructor
+    //  Initializes the members only, the file is read by load
+    LarmorSound::LarmorSound(const AnalysisOptions &options, LoadProgress *progress) :
+        initedCreation(false), loadStatus(LOAD_PENDING), loadProgress(progress),
+        channels_samples(NULL), channels_pcm(NULL), spectrum_samples(NULL), spectrum_codes(NULL), energy_samples(NULL),
+        rms_samples(NULL), peak_samples(NULL), energy_prefix(NULL), spectrum_prefix(NULL), lazyAnalysis(NULL),
+        analysisCache(NULL), readahead(NULL), sharedAsset(NULL),
+        playbackCommands(new SPSCQueue<PlaybackCommand>(PLAYBACK_COMMAND_QUEUE_SIZE)),
+        interleaved_samples(NULL), playbackInterleaved(NULL)
     {
         std::cout << "LarmorSound API v.1.0 Beta 04/11/2016\nAuthor: Pier Paolo \"Larmor\" Ciarravano http://www.larmor.com" << std::endl;
 
         // init member variables
         initedCreation = false;
+        loadComplete = false;
+        numSamples = 0;
         initedPlay = false;
         playing = false;
         playPosition = 0;
@@ -47,7 +267,32 @@ namespace Larmor {
         heartbeatActive = false;
         heartbeatThreshold = HEARTBEAT_THRESHOLD_DEFAULT;
         heartbeatLast = 0;
+        // Load timings
+        loadTimings.decodeSeconds = 0.0;
+        loadTimings.analysisSeconds = 0.0;
+        loadTimings.storeSeconds = 0.0;
+        loadTimings.totalSeconds = 0.0;
+        loadTimings.analysisThreads = 0;
+        memset(&playbackSpec, 0, sizeof(playbackSpec));
+        clockSequence = 0;
+        clockPosition = 0;
+        clockFrames = 0;
+        clockTimeNs = 0;
+        playbackGain = 1.0f;
+        mixerVoice = false;
+        mixerStatus = MIXER_OK;
+        renderOutput = false;
+        renderTimeNs = 0;
+        memset(&renderStats, 0, sizeof(renderStats));
+        analysisOptions = options;
+    }
 
+    // Reads the file and computes the analysis. With loadProgress, the progress is updated at
+    //  every stored block, cancelRequested stops the decode stage (the blocks already decoded
+    //  are drained and the object is not created) and the object is readable during the loading:
+    //  numSamples is the watermark of the samples whose frames are analyzed, published after them
+    void LarmorSound::load(const char *filename)
+    {
         // deactivation when date_millisec > val1 * val2 on 1st April 2017 (millisec: 1491001200000 = 1146924 * 1300000)
         // https://currentmillis.com/
         uint64_t time_ms_to_1 = 1146924;
@@ -58,118 +303,631 @@ namespace Larmor {
         //std::cout << "TIME DEPRECATED: " << time_ms_to << std::endl;
         if (time_ms_now > time_ms_to) {
             std::cout << "LarmorSound API v.1.0 Beta is deprecated, please visit the author website for further information: http://www.larmor.com" << std::endl;
+            loadStatus = LOAD_ERROR_DEPRECATED;
             return;
         }
 
-        // Aubio FFT
-        uint32_t win_s = AUBIO_SAMPLE_BUFFER_SIZE; // window size
-        fvec_t * in = new_fvec(win_s); // input buffer
-        cvec_t * fftgrain = new_cvec(win_s); // FFT norm and phase
-        // create FFT object
-        aubio_fft_t * fft = new_aubio_fft(win_s);
-        if (!fft) {
-            std::cout << "LarmorSound:: Error: could not create fft object!" << std::endl;
+        // Input from Aubio
+        uint32_t win_s = analysisOptions.fftSize; // window size
+        uint32_t hop_s = analysisOptions.hopSize; // distance between the frames
+        if (win_s < 2 || (win_s & (win_s - 1)) != 0 || hop_s == 0 || hop_s > win_s) {
+            std::cout << "LarmorSound:: Error: invalid analysis options: fftSize " << win_s
+                << " hopSize " << hop_s << ", fftSize must be a power of 2 and 0 < hopSize <= fftSize" << std::endl;
+            loadStatus = LOAD_ERROR_OPTIONS;
+            return;
+        }
+        if (!(analysisOptions.rangeStartSeconds >= 0) || !(analysisOptions.rangeEndSeconds >= 0)
+            || (analysisOptions.rangeEndSeconds > 0 && analysisOptions.rangeEndSeconds <= analysisOptions.rangeStartSeconds)) {
+            std::cout << "LarmorSound:: Error: invalid analysis options: range " << analysisOptions.rangeStartSeconds
+                << "s to " << analysisOptions.rangeEndSeconds << "s, the start must be before the end"
+                " (0 is the end of the file)" << std::endl;
+            loadStatus = LOAD_ERROR_OPTIONS;
+            return;
+        }
+        if (analysisOptions.spectrumStorage != SPECTRUM_STORAGE_FLOAT && !(analysisOptions.spectrumRangeDb > 0)) {
+            std::cout << "LarmorSound:: Error: invalid analysis options: spectrumRangeDb "
+                << analysisOptions.spectrumRangeDb << ", it must be greater than 0" << std::endl;
+            loadStatus = LOAD_ERROR_OPTIONS;
             return;
         }
 
-        // Input from Aubio
+        // Analysis cache: when the file has already been analyzed, map the cache file and return.
+        //  The asset cache, checked first, has the analyses in use or kept in memory
+        AnalysisCacheKey cache_key;
+        std::string cache_path;
+        bool use_cache = false;
+        bool use_assets = AssetCache::isActive();
+        {
+            std::lock_guard<std::mutex> lock(cacheConfigMutex);
+            bool keyed = (cacheActive || use_assets) && AnalysisCache::makeKey(filename, analysisOptions, cache_key);
+            use_cache = cacheActive && keyed;
+            use_assets = use_assets && keyed;
+            if (use_cache) {
+                cache_path = AnalysisCache::makePath(cache_key, cacheDirectory);
+            }
+        }
+        if (use_assets) {
+            SharedAsset *asset = AssetCache::acquire(cache_key);
+            if (asset != NULL) {
+                adoptAsset(asset);
+                std::cout << "LarmorSound:: shared " << (numSamples * 1.0 / samplerate)
+                    << "s analysis of " << filename << " from the asset cache" << std::endl;
+                return;
+            }
+        }
+        if (use_cache && loadAnalysisCache(cache_path, cache_key)) {
+            if (use_assets) {
+                shareAsset(cache_key);
+            }
+            loadComplete = true;
+            loadStatus = LOAD_OK;
+            initedCreation = true;
+            if (loadProgress != NULL) {
+                loadProgress->blocksTotal = energy_samples->getNumRows();
+                loadProgress->blocksDone = energy_samples->getNumRows();
+                loadProgress->readable = true;
+            }
+            return;
+        }
         uint32_t samplerate_read = 0;
         uint32_t n_channels = 0;
         aubio_source_t *this_source = NULL;
         std::stringstream filename_str;
         filename_str << filename;
-        this_source = new_aubio_source(filename_str.str().c_str(), samplerate_read, win_s);
-        n_channels = aubio_source_get_channels(this_source);
-        numChannels = n_channels;
-        fmat_t *mat_in = new_fmat(n_channels, win_s);
+        this_source = AubioState::newSource(filename_str.str().c_str(), samplerate_read, win_s);
         if (this_source == NULL) {
             std::cout << "LarmorSound:: Error: could not open input file: " << filename_str.str() << std::endl;
+            loadStatus = LOAD_ERROR_OPEN;
             return;
         }
+        uint32_t source_channels_count = aubio_source_get_channels(this_source);
         if (samplerate_read == 0) {
             samplerate_read = aubio_source_get_samplerate(this_source);
             samplerate = samplerate_read;
         }
-        
-        // Prepare channels_samples and FFT spectrum samples
-        for (uint8_t channel = 0; channel < n_channels; channel++)
+
+        // Partial loading: only the channels of channelMask and the samples of the range are
+        //  stored and analyzed, the source is read from the start of the range
+        std::vector<uint8_t> source_channels;
+        for (uint32_t c = 0; c < source_channels_count && c < UINT8_MAX; c++)
         {
-            // audio sample
-            vect_smpl channel_sample;
-            channels_samples.push_back(channel_sample);
-            // FFT spectrum sample
-            vect_vect_smpl spectrum_sample;
-            spectrum_samples.push_back(spectrum_sample);
+            if (analysisOptions.channelMask == 0 || (c < 32 && (analysisOptions.channelMask >> c) & 1)) {
+                source_channels.push_back(c);
+            }
+        }
+        n_channels = source_channels.size();
+        numChannels = n_channels;
+        uint32_t duration = aubio_source_get_duration(this_source);
+        uint32_t range_start = rangeSampleOffset(analysisOptions.rangeStartSeconds, samplerate);
+        uint32_t range_end = analysisOptions.rangeEndSeconds > 0
+            ? rangeSampleOffset(analysisOptions.rangeEndSeconds, samplerate) : UINT32_MAX;
+        if (n_channels == 0 || (duration > 0 && range_start >= duration)) {
+            std::cout << "LarmorSound:: Error: nothing to load in " << filename_str.str() << ": channelMask "
+                << analysisOptions.channelMask << " of " << source_channels_count << " channels, range start "
+                << range_start << " of " << duration << " samples" << std::endl;
+            AubioState::deleteSource(this_source);
+            loadStatus = LOAD_ERROR_OPTIONS;
+            return;
+        }
+        if (range_start > 0 && aubio_source_seek(this_source, range_start) != 0) {
+            std::cout << "LarmorSound:: Error: could not seek input file: " << filename_str.str() << std::endl;
+            AubioState::deleteSource(this_source);
+            loadStatus = LOAD_ERROR_OPEN;
+            return;
+        }
+        uint32_t range_samples = range_end - range_start;
+        if (duration > 0) {
+            duration = std::min(duration, range_end) - range_start;
         }
 
-        std::cout << "LarmorSound:: Reading input file and computing spectrum..." << std::endl;
-        uint32_t read = 0;
-        uint32_t total_read = 0;
-        uint32_t blocks = 0;
+        // Analysis window, empty for the rectangular one so the frames are not modified
+        vect_smpl window;
+        if (analysisOptions.window != WINDOW_RECTANGULAR) {
+            fvec_t *window_values = new_aubio_window(const_cast<char *>(aubioWindowName(analysisOptions.window)), win_s);
+            if (window_values == NULL) {
+                std::cout << "LarmorSound:: Error: could not create analysis window!" << std::endl;
+                AubioState::deleteSource(this_source);
+                loadStatus = LOAD_ERROR_ANALYSIS;
+                return;
+            }
+            window.assign(window_values->data, window_values->data + win_s);
+            del_fvec(window_values);
+        }
 
-        do
+        fmat_t *mat_in = new_fmat(source_channels_count, win_s);
+
+        // Prepare channels_samples and FFT spectrum samples:
+        //  sized up front from the source duration, so they are not reallocated while reading;
+        //  when the duration is unknown they grow geometrically, starting from one chunk
+        uint32_t reserved_samples = duration > 0 ? duration : SAMPLES_GROWTH_CHUNK;
+        uint32_t reserved_blocks = reserved_samples / hop_s + 1;
+        bool pcm = (analysisOptions.sampleStorage == SAMPLE_STORAGE_INT16);
+        bool reserved = true;
+        if (pcm) {
+            channels_pcm = newArena<int16_t>(n_channels, 1, analysisOptions.mappedStorage);
+            reserved = channels_pcm->reserve(reserved_samples);
+        } else {
+            channels_samples = newArena<smpl_t>(n_channels, 1, analysisOptions.mappedStorage);
+            reserved = channels_samples->reserve(reserved_samples);
+        }
+        uint32_t n_bins = win_s / 2 + 1;
+        SpectrumQuantizer quantizer(analysisOptions);
+        bool quantized = (analysisOptions.spectrumStorage != SPECTRUM_STORAGE_FLOAT);
+        uint32_t code_row_bytes = quantized ? quantizer.getRowBytes(n_bins) : 0;
+        if (quantized) {
+            spectrum_codes = newArena<uint8_t>(n_channels, code_row_bytes, analysisOptions.mappedStorage);
+            reserved = spectrum_codes->reserve(reserved_blocks) && reserved;
+        } else {
+            spectrum_samples = newArena<smpl_t>(n_channels, n_bins, analysisOptions.mappedStorage);
+            reserved = spectrum_samples->reserve(reserved_blocks) && reserved;
+        }
+        energy_samples = newArena<smpl_t>(n_channels, 1, analysisOptions.mappedStorage);
+        reserved = energy_samples->reserve(reserved_blocks) && reserved;
+        rms_samples = newArena<smpl_t>(n_channels, 1, analysisOptions.mappedStorage);
+        reserved = rms_samples->reserve(reserved_blocks) && reserved;
+        peak_samples = newArena<smpl_t>(n_channels, 1, analysisOptions.mappedStorage);
+        reserved = peak_samples->reserve(reserved_blocks) && reserved;
+        if (!reserved) {
+            std::cout << "LarmorSound:: Error: could not allocate the storage of " << filename_str.str()
+                << " (" << reserved_samples << " samples)" << std::endl;
+            del_fmat(mat_in);
+            AubioState::deleteSource(this_source);
+            loadStatus = LOAD_ERROR_ANALYSIS;
+            return;
+        }
+        if (loadProgress != NULL) {
+            loadProgress->blocksTotal = duration > 0 ? duration / hop_s + 1 : 0;
+            // The readers keep the rows they got while the arenas grow
+            if (pcm) {
+                channels_pcm->setRetainOnGrow(true);
+            } else {
+                channels_samples->setRetainOnGrow(true);
+            }
+            if (quantized) {
+                spectrum_codes->setRetainOnGrow(true);
+            } else {
+                spectrum_samples->setRetainOnGrow(true);
+            }
+            energy_samples->setRetainOnGrow(true);
+            rms_samples->setRetainOnGrow(true);
+            peak_samples->setRetainOnGrow(true);
+            initedCreation = true;
+            loadProgress->readable = true;
+        }
+
+        // Lazy analysis: only the samples are read now, the frames are analyzed on demand
+        if (analysisOptions.lazySpectrum) {
+            std::cout << "LarmorSound:: Reading input file, spectrum computed on demand..." << std::endl;
+            stage_clock::time_point lazy_start = stage_clock::now();
+            bool lazy_cancelled = false;
+            bool lazy_storage_failed = false;
+            uint32_t lazy_read = pcm
+                ? decodeSamples(this_source, mat_in, hop_s, source_channels, range_samples, *channels_pcm,
+                    loadProgress, lazy_cancelled, lazy_storage_failed)
+                : decodeSamples(this_source, mat_in, hop_s, source_channels, range_samples, *channels_samples,
+                    loadProgress, lazy_cancelled, lazy_storage_failed);
+            loadTimings.decodeSeconds = elapsedSeconds(lazy_start);
+            del_fmat(mat_in);
+            AubioState::deleteSource(this_source);
+            if (lazy_cancelled) {
+                std::cout << "LarmorSound:: loading cancelled: " << filename << std::endl;
+                initedCreation = false;
+                loadStatus = LOAD_CANCELLED;
+                return;
+            }
+            if (lazy_storage_failed) {
+                std::cout << "LarmorSound:: Error: could not store the samples of " << filename_str.str()
+                    << " after " << lazy_read << " samples" << std::endl;
+                initedCreation = false;
+                loadStatus = LOAD_ERROR_ANALYSIS;
+                return;
+            }
+            if (!startLazyAnalysis(lazy_read, window)) {
+                initedCreation = false;
+                loadStatus = LOAD_ERROR_ANALYSIS;
+                return;
+            }
+            loadTimings.totalSeconds = elapsedSeconds(lazy_start);
+            std::cout << "LarmorSound:: read " << (numSamples * 1.0 / samplerate)
+                << "s (" << numSamples
+                << " samples, " << energy_samples->getNumRows()
+                << " frames analyzed on demand) from " << filename_str.str()
+                << " at " << samplerate << "Hz in " << loadTimings.totalSeconds << "s" << std::endl;
+            return;
+        }
+
+        // Worker pool for the analysis stage
+        WorkerPool pool(analysisOptions.numThreads);
+        uint32_t n_workers = pool.getNumThreads();
+
+        // Aubio FFT: aubio objects are not thread safe, so each worker owns its own
+        // FFT object and output grain
+        std::vector<aubio_fft_t *> ffts(n_workers, (aubio_fft_t *)NULL);
+        std::vector<cvec_t *> fftgrains(n_workers, (cvec_t *)NULL);
+        bool fft_created = true;
+        for (uint32_t w = 0; w < n_workers; w++)
         {
-            // read from source
-            aubio_source_do_multi(this_source, mat_in, &read);
+            ffts[w] = AubioState::newFFT(win_s);
+            fftgrains[w] = new_cvec(win_s); // FFT norm and phase
+            fft_created = fft_created && (ffts[w] != NULL);
+        }
+        if (!fft_created) {
+            std::cout << "LarmorSound:: Error: could not create fft object!" << std::endl;
+            deleteFFTWorkers(ffts, fftgrains);
+            del_fmat(mat_in);
+            AubioState::deleteSource(this_source);
+            initedCreation = false;
+            loadStatus = LOAD_ERROR_ANALYSIS;
+            return;
+        }
 
-            for (uint8_t channel = 0; channel < n_channels; channel++)
+        std::cout << "LarmorSound:: Reading input file and computing spectrum on " << n_workers
+            << " threads (" << getSpectrumKernels().name << " kernels)..." << std::endl;
+        stage_clock::time_point load_start = stage_clock::now();
+
+        // The decode and the analysis stages run concurrently, connected by a ring of blocks:
+        //  loading takes about the time of the slowest stage instead of the sum of both
+        BlockRing ring(n_workers * 2 + 2, n_channels, win_s, n_bins, code_row_bytes);
+        spectrum_kernel kernel = selectSpectrumKernel(analysisOptions.spectrumMode);
+        uint32_t total_read = 0;
+        uint32_t blocks = 0;
+        double decode_time = 0.0;
+        bool cancelled = false;
+        std::atomic<bool> storage_failed(false); // set by the decode or the store stage
+
+        // Decode stage: reads the source and stores the track samples, then copies the
+        //  frames to analyze from the stored samples, so overlapping frames (hopSize < fftSize)
+        //  never read the source again. The frames after the end of the track are zero padded,
+        //  as aubio_source_do_multi does for the last block
+        std::thread decoder([&]() {
+            bool end_of_source = false;
+            do
             {
+                stage_clock::time_point start = stage_clock::now();
 
-                fmat_get_channel(mat_in, channel, in);
+                // read from source, up to the end of the range
+                uint32_t read = readSource(this_source, mat_in, range_samples - total_read);
 
                 // Store track sample
-                for (uint32_t i = 0; i < read; i++) {
-                    channels_samples[channel].push_back(in->data[i]);
+                bool stored = pcm
+                    ? appendSamples(*channels_pcm, mat_in, source_channels, read)
+                    : appendSamples(*channels_samples, mat_in, source_channels, read);
+                if (!stored) {
+                    storage_failed = true;
+                    break;
+                }
+                total_read += read;
+                decode_time += elapsedSeconds(start);
+
+                // Frames complete with the samples read so far, at the end of the source
+                //  all the frames starting before or at the last sample
+                end_of_source = (read != win_s || total_read == range_samples);
+                while ((uint64_t)blocks * hop_s + win_s <= total_read
+                    || (end_of_source && blocks <= total_read / hop_s))
+                {
+                    AnalysisBlock *block = ring.freeBlocks.pop();
+                    start = stage_clock::now();
+                    uint32_t frame_start = blocks * hop_s;
+                    uint32_t frame_read = std::min(win_s, total_read - frame_start);
+                    for (uint8_t channel = 0; channel < n_channels; channel++)
+                    {
+                        smpl_t *frame = block->samples->data[channel];
+                        readStoredSamples(channels_samples, channels_pcm, channel, frame_start, frame_read, frame);
+                        std::fill(frame + frame_read, frame + win_s, (smpl_t)0.0);
+                    }
+                    block->index = blocks;
+                    block->read = frame_read;
+                    blocks++;
+                    decode_time += elapsedSeconds(start);
+                    ring.decodedBlocks.push(block);
+                }
+
+                if (loadProgress != NULL && loadProgress->cancelRequested) {
+                    cancelled = true;
                 }
 
-                // Clean previous values
-                cvec_zeros(fftgrain);
+            } while (!end_of_source && !cancelled && !storage_failed);
+            ring.decodedBlocks.close();
+        });
 
-                // Compute FFT
-                aubio_fft_do(fft, in, fftgrain);
+        // Analysis stage: each worker computes the FFT of all the channels of a decoded block
+        std::vector<double> analysis_times(n_workers, 0.0);
+        std::atomic<uint32_t> running_workers(n_workers);
+        for (uint32_t w = 0; w < n_workers; w++)
+        {
+            pool.submit([&](uint32_t worker) {
+                AnalysisBlock *block = NULL;
+                while ((block = ring.decodedBlocks.pop()) != NULL)
+                {
+                    stage_clock::time_point start = stage_clock::now();
+                    for (uint8_t channel = 0; channel < n_channels; channel++)
+                    {
+                        analyzeBlockChannel(ffts[worker], fftgrains[worker], window, kernel,
+                            quantized ? &quantizer : NULL, block, channel);
+                    }
+                    analysis_times[worker] += elapsedSeconds(start);
+                    ring.analyzedBlocks.push(block);
+                }
+                if (--running_workers == 0) {
+                    ring.analyzedBlocks.close();
+                }
+            });
+        }
 
-                // Store FFT sample
-                vect_smpl spectrum_values;
-                for (uint32_t j = 0; j < fftgrain->length; j++)
+        // Store stage: copies the spectra and the levels of the analyzed blocks in the arenas,
+        //  the blocks can arrive out of order
+        double store_time = 0.0;
+        std::vector<uint32_t> block_ends; // end + 1 of the frame of the stored blocks, 0 if not stored
+        uint32_t ready_blocks = 0;
+        AnalysisBlock *block = NULL;
+        while ((block = ring.analyzedBlocks.pop()) != NULL)
+        {
+            if (storage_failed) {
+                // the remaining blocks are dropped until the decode stage stops
+                ring.freeBlocks.push(block);
+                continue;
+            }
+            stage_clock::time_point start = stage_clock::now();
+            if (energy_samples->getNumRows() <= block->index) {
+                bool stored = quantized ? spectrum_codes->resize(block->index + 1)
+                    : spectrum_samples->resize(block->index + 1);
+                stored = stored && energy_samples->resize(block->index + 1)
+                    && rms_samples->resize(block->index + 1)
+                    && peak_samples->resize(block->index + 1);
+                if (!stored) {
+                    storage_failed = true;
+                    ring.freeBlocks.push(block);
+                    continue;
+                }
+            }
+            for (uint8_t channel = 0; channel < n_channels; channel++)
+            {
+                if (quantized) {
+                    memcpy(spectrum_codes->row(channel, block->index), block->codes->row(channel, 0),
+                        code_row_bytes);
+                } else {
+                    memcpy(spectrum_samples->row(channel, block->index), block->spectra->row(channel, 0),
+                        n_bins * sizeof(smpl_t));
+                }
+                *energy_samples->row(channel, block->index) = block->energy[channel];
+                *rms_samples->row(channel, block->index) = block->rms[channel];
+                *peak_samples->row(channel, block->index) = block->peak[channel];
+            }
+            store_time += elapsedSeconds(start);
+            if (loadProgress != NULL) {
+                // Watermark: the samples of the contiguous prefix of stored blocks, up to the
+                //  start of the first missing frame
+                if (block_ends.size() <= block->index) {
+                    block_ends.resize(block->index + 1, 0);
+                }
+                block_ends[block->index] = block->index * hop_s + block->read + 1;
+                while (ready_blocks < block_ends.size() && block_ends[ready_blocks] != 0)
                 {
-                    smpl_t val = sqrt(fftgrain->norm[j]*fftgrain->norm[j] + fftgrain->phas[j]*fftgrain->phas[j]);
-                    spectrum_values.push_back(val);
+                    ready_blocks++;
                 }
-                spectrum_samples[channel].push_back(spectrum_values);
+                if (ready_blocks > 0) {
+                    uint32_t ready = std::min((uint64_t)ready_blocks * hop_s, (uint64_t)block_ends[ready_blocks - 1] - 1);
+                    if (ready > numSamples) {
+                        numSamples.store(ready, std::memory_order_release);
+                    }
+                }
+                loadProgress->blocksDone++;
             }
-
-            blocks++;
-            total_read += read;
-
-        } while (read == win_s);
+            ring.freeBlocks.push(block);
+        }
+        decoder.join();
+        pool.wait();
+
+        if (cancelled) {
+            std::cout << "LarmorSound:: loading cancelled: " << filename << std::endl;
+            deleteFFTWorkers(ffts, fftgrains);
+            del_fmat(mat_in);
+            AubioState::deleteSource(this_source);
+            initedCreation = false;
+            loadStatus = LOAD_CANCELLED;
+            return;
+        }
+        if (storage_failed) {
+            std::cout << "LarmorSound:: Error: could not store the analysis of " << filename_str.str()
+                << " after " << total_read << " samples" << std::endl;
+            deleteFFTWorkers(ffts, fftgrains);
+            del_fmat(mat_in);
+            AubioState::deleteSource(this_source);
+            initedCreation = false;
+            loadStatus = LOAD_ERROR_ANALYSIS;
+            return;
+        }
 
         numSamples = total_read;
+        std::call_once(energyPrefixOnce, &LarmorSound::computeEnergyPrefix, this);
+        loadComplete = true;
+
+        loadTimings.decodeSeconds = decode_time;
+        loadTimings.analysisSeconds = 0.0;
+        for (uint32_t w = 0; w < n_workers; w++)
+        {
+            loadTimings.analysisSeconds += analysis_times[w];
+        }
+        loadTimings.storeSeconds = store_time;
+        loadTimings.totalSeconds = elapsedSeconds(load_start);
+        loadTimings.analysisThreads = n_workers;
 
         std::cout << "LarmorSound:: read " << (numSamples * 1.0 / samplerate)
             << "s (" << numSamples
             << " samples in " << blocks
-            << " blocks of " << win_s
+            << " frames of " << win_s
+            << " hop " << hop_s
             << ") from " << filename_str.str()
             << " at " << samplerate << "Hz" << std::endl;
+        std::cout << "LarmorSound:: load timings: decode " << loadTimings.decodeSeconds
+            << "s, analysis " << loadTimings.analysisSeconds
+            << "s (on " << loadTimings.analysisThreads
+            << " threads), store " << loadTimings.storeSeconds
+            << "s, total " << loadTimings.totalSeconds << "s" << std::endl;
 
         // Close resources
-        del_aubio_fft(fft);
-        //del_fvec(in); // return "double free or corruption" error
+        deleteFFTWorkers(ffts, fftgrains);
         del_fmat(mat_in);
-        del_cvec(fftgrain);
-        del_aubio_source(this_source);
-        aubio_cleanup();
+        AubioState::deleteSource(this_source);
+
+        if (use_cache) {
+            if (AnalysisCache::save(cache_path, cache_key, samplerate, numSamples, channels_samples, channels_pcm,
+                    spectrum_samples, spectrum_codes, *energy_samples, *rms_samples, *peak_samples)) {
+                std::cout << "LarmorSound:: analysis cache written: " << cache_path << std::endl;
+            } else {
+                std::cout << "LarmorSound:: Error: could not write analysis cache: " << cache_path << std::endl;
+            }
+        }
+
+        if (use_assets) {
+            shareAsset(cache_key);
+        }
 
+        if (loadProgress != NULL) {
+            loadProgress->blocksTotal = blocks; // exact now, the duration is an estimate
+        }
+        loadStatus = LOAD_OK;
         initedCreation = true;
     }
 
+    // Borrows the arenas of a shared asset, the object is then created
+    void LarmorSound::adoptAsset(SharedAsset *asset)
+    {
+        sharedAsset = asset;
+        numSamples = asset->numSamples;
+        samplerate = asset->samplerate;
+        numChannels = asset->numChannels;
+        analysisOptions.fftSize = asset->options.fftSize;
+        analysisOptions.hopSize = asset->options.hopSize;
+        analysisOptions.window = asset->options.window;
+        analysisOptions.spectrumMode = asset->options.spectrumMode;
+        analysisOptions.spectrumStorage = asset->options.spectrumStorage;
+        analysisOptions.spectrumScale = asset->options.spectrumScale;
+        analysisOptions.spectrumRangeDb = asset->options.spectrumRangeDb;
+        analysisOptions.sampleStorage = asset->options.sampleStorage;
+        channels_samples = asset->samples;
+        channels_pcm = asset->pcm;
+        spectrum_samples = asset->spectrum;
+        spectrum_codes = asset->codes;
+        energy_samples = asset->energy;
+        rms_samples = asset->rms;
+        peak_samples = asset->peak;
+        energy_prefix = asset->energyPrefix;
+        std::call_once(energyPrefixOnce, []() {}); // the shared prefix is already built
+
+        loadComplete = true;
+        loadStatus = LOAD_OK;
+        initedCreation = true;
+        if (loadProgress != NULL) {
+            loadProgress->blocksTotal = energy_samples->getNumRows();
+            loadProgress->blocksDone = energy_samples->getNumRows();
+            loadProgress->readable = true;
+        }
+    }
+
+    // Hands the arenas of a complete analysis to the asset cache, the object keeps them
+    //  as borrowed. Nothing changes if an asset of the same key has been published meanwhile,
+    //  or if the energy prefix sums could not be allocated (the adopters never build them)
+    void LarmorSound::shareAsset(const AnalysisCacheKey &cacheKey)
+    {
+        if (energy_prefix == NULL) {
+            return;
+        }
+        SharedAsset *asset = new SharedAsset();
+        asset->numSamples = numSamples;
+        asset->samplerate = samplerate;
+        asset->numChannels = numChannels;
+        asset->options = analysisOptions;
+        asset->samples = channels_samples;
+        asset->pcm = channels_pcm;
+        asset->spectrum = spectrum_samples;
+        asset->codes = spectrum_codes;
+        asset->energy = energy_samples;
+        asset->rms = rms_samples;
+        asset->peak = peak_samples;
+        asset->energyPrefix = energy_prefix;
+        asset->analysisCache = analysisCache;
+        if (AssetCache::publish(cacheKey, asset)) {
+            sharedAsset = asset;
+        } else {
+            delete asset; // the arenas stay owned by this object
+        }
+    }
+
+    // The loading is complete, so the callbacks started from now on read the current arenas:
+    //  locking the audio device waits for the one that may still read a replaced arena
+    void LarmorSound::releaseRetiredArenas()
+    {
+        mutex.lock();
+        if (initedPlay && mixerVoice) {
+            std::lock_guard<std::mutex> lock(mixerMutex);
+            sharedMixer->waitCallback();
+        } else if (initedPlay && !renderOutput) {
+            SDL_LockAudio();
+            SDL_UnlockAudio();
+        }
+        if (channels_samples != NULL) {
+            channels_samples->releaseRetired();
+        }
+        if (channels_pcm != NULL) {
+            channels_pcm->releaseRetired();
+        }
+        if (spectrum_samples != NULL) {
+            spectrum_samples->releaseRetired();
+        }
+        if (spectrum_codes != NULL) {
+            spectrum_codes->releaseRetired();
+        }
+        energy_samples->releaseRetired();
+        rms_samples->releaseRetired();
+        peak_samples->releaseRetired();
+        if (sharedAsset != NULL) {
+            AssetCache::updateBytes(sharedAsset);
+        }
+        mutex.unlock();
+    }
+
     // Destructor
     LarmorSound::~LarmorSound()
     {
         std::cout << "LarmorSound:: Destructor" << std::endl;
-        if (initedPlay) {
+        if (initedPlay && mixerVoice) {
+            std::lock_guard<std::mutex> lock(mixerMutex);
+            sharedMixer->removeVoice(this);
+        } else if (initedPlay && !renderOutput) {
             SDL_CloseAudio();
         }
+        delete lazyAnalysis; // stops the prefetch thread before the arenas are deleted
+        delete readahead;
+        if (sharedAsset != NULL) {
+            // The shared arenas belong to the asset cache, the copies kept for the readers
+            //  of this object are not needed anymore
+            if (loadProgress != NULL && loadComplete) {
+                releaseRetiredArenas();
+            }
+            channels_samples = NULL;
+            channels_pcm = NULL;
+            spectrum_samples = NULL;
+            spectrum_codes = NULL;
+            energy_samples = NULL;
+            rms_samples = NULL;
+            peak_samples = NULL;
+            energy_prefix = NULL;
+            analysisCache = NULL;
+            AssetCache::release(sharedAsset);
+        }
+        delete channels_samples;
+        delete channels_pcm;
+        delete spectrum_samples;
+        delete spectrum_codes;
+        delete energy_samples;
+        delete rms_samples;
+        delete peak_samples;
+        delete energy_prefix;
+        delete spectrum_prefix;
+        delete analysisCache;
+        delete playbackCommands;
+        delete interleaved_samples;
     }
 
     uint32_t LarmorSound::getNumSamples()
@@ -199,36 +957,133 @@ namespace Larmor {
         return numChannels;
     }
 
-    vect_smpl* LarmorSound::getChannelSample(uint8_t numChannel)
+    uint32_t LarmorSound::getSourceOffset()
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0;
+        }
+        return rangeSampleOffset(analysisOptions.rangeStartSeconds, samplerate);
+    }
+
+    SmplView LarmorSound::getChannelSample(uint8_t numChannel)
     {
         if (!initedCreation) {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
-            return NULL;
+            return SmplView();
         }
         if (numChannel >= numChannels) {
             std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
-            return NULL;
+            return SmplView();
         }
-        return &channels_samples[numChannel];
+        if (channels_samples == NULL) {
+            std::cout << "LarmorSound:: error samples are stored as int16, use getChannelSamples!" << std::endl;
+            return SmplView();
+        }
+        // The watermark before the row: the arena read has all the samples up to it
+        uint32_t ready = numSamples.load(std::memory_order_acquire);
+        return SmplView(channels_samples->row(numChannel, 0), ready);
     }
 
-    vect_smpl* LarmorSound::getChannelSpectrum(uint8_t numChannel, uint32_t position)
+    bool LarmorSound::getChannelSamples(uint8_t numChannel, uint32_t position, uint32_t count, vect_smpl &samples)
     {
         if (!initedCreation) {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
-            return NULL;
+            return false;
         }
         if (numChannel >= numChannels) {
             std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
-            return NULL;
+            return false;
+        }
+        uint32_t ready = numSamples.load(std::memory_order_acquire);
+        if (position >= ready) {
+            std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
+            return false;
+        }
+
+        // Only the samples of the range are decoded
+        samples.resize(std::min(count, ready - position));
+        if (!samples.empty()) {
+            readStoredSamples(channels_samples, channels_pcm, numChannel, position, samples.size(), &samples[0]);
+        }
+        return true;
+    }
+
+    SmplView LarmorSound::getChannelSpectrum(uint8_t numChannel, uint32_t position)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return SmplView();
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return SmplView();
         }
         if (position >= numSamples) {
             std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
-            return NULL;
+            return SmplView();
+        }
+        if (spectrum_samples == NULL) {
+            std::cout << "LarmorSound:: error spectrum is quantized, use getChannelSpectrum with a vector"
+                " or getChannelSpectrumCodes!" << std::endl;
+            return SmplView();
         }
 
-        uint32_t block = position / AUBIO_SAMPLE_BUFFER_SIZE;
-        return &spectrum_samples[numChannel][block];
+        uint32_t block = position / analysisOptions.hopSize;
+        ensureBlock(block);
+        return SmplView(spectrum_samples->row(numChannel, block), spectrum_samples->getRowSize());
+    }
+
+    bool LarmorSound::getChannelSpectrum(uint8_t numChannel, uint32_t position, vect_smpl &spectrum)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return false;
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return false;
+        }
+        if (position >= numSamples) {
+            std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
+            return false;
+        }
+
+        spectrum.resize(analysisOptions.fftSize / 2 + 1);
+        ensureBlock(position / analysisOptions.hopSize);
+        readSpectrumRow(numChannel, position / analysisOptions.hopSize, &spectrum[0]);
+        return true;
+    }
+
+    bool LarmorSound::getChannelSpectrumCodes(uint8_t numChannel, uint32_t position, SpectrumCodes &codes)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return false;
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return false;
+        }
+        if (position >= numSamples) {
+            std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
+            return false;
+        }
+        if (spectrum_codes == NULL) {
+            std::cout << "LarmorSound:: error spectrum is not quantized, use getChannelSpectrum!" << std::endl;
+            return false;
+        }
+
+        ensureBlock(position / analysisOptions.hopSize);
+        const uint8_t *row = spectrum_codes->row(numChannel, position / analysisOptions.hopSize);
+        const uint8_t *rowCodes = row + SPECTRUM_CODES_HEADER_BYTES;
+        bool codes8 = (analysisOptions.spectrumStorage == SPECTRUM_STORAGE_LOG8);
+        codes.codes8 = codes8 ? rowCodes : NULL;
+        codes.codes16 = codes8 ? NULL : reinterpret_cast<const uint16_t *>(rowCodes);
+        codes.size = analysisOptions.fftSize / 2 + 1;
+        codes.floorDb = SpectrumQuantizer::rowFloorDb(row);
+        codes.stepDb = SpectrumQuantizer::rowStepDb(row);
+        return true;
     }
 
     smpl_t LarmorSound::getChannelEnergy(uint8_t numChannel, uint32_t position)
@@ -246,56 +1101,431 @@ namespace Larmor {
             return 0.0;
         }
 
-        uint32_t block = position / AUBIO_SAMPLE_BUFFER_SIZE;
-        smpl_t channelEnergy = 0.0;
-        for (uint32_t i = 0; i < spectrum_samples[numChannel][block].size(); i++)
-        {
-            channelEnergy += spectrum_samples[numChannel][block][i];
+        uint32_t block = position / analysisOptions.hopSize;
+        ensureBlock(block);
+        return *energy_samples->row(numChannel, block);
+    }
+
+    smpl_t LarmorSound::getChannelRMS(uint8_t numChannel, uint32_t position)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0.0;
         }
-        return channelEnergy;
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return 0.0;
+        }
+        if (position >= numSamples) {
+            std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
+            return 0.0;
+        }
+
+        uint32_t block = position / analysisOptions.hopSize;
+        ensureBlock(block);
+        return *rms_samples->row(numChannel, block);
     }
 
-    void LarmorSound::setHeartbeatActive(bool active, uint64_t heartbeatThresholdParam) {
+    smpl_t LarmorSound::getChannelPeak(uint8_t numChannel, uint32_t position)
+    {
         if (!initedCreation) {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
-            return;
+            return 0.0;
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return 0.0;
+        }
+        if (position >= numSamples) {
+            std::cout << "LarmorSound:: error position: " << position << " does not exist!" << std::endl;
+            return 0.0;
         }
-        mutex.lock();
 
-        heartbeatActive = active;
-        if (heartbeatThresholdParam != 0) {
-            heartbeatThreshold = heartbeatThresholdParam;
+        uint32_t block = position / analysisOptions.hopSize;
+        ensureBlock(block);
+        return *peak_samples->row(numChannel, block);
+    }
+
+    smpl_t LarmorSound::getChannelEnergyRange(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0.0;
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return 0.0;
+        }
+        if (!loadComplete) {
+            std::cout << "LarmorSound:: error: range queries need the complete loading!" << std::endl;
+            return 0.0;
+        }
+        if (startPosition >= endPosition || endPosition > numSamples) {
+            std::cout << "LarmorSound:: error range: [" << startPosition << ", " << endPosition << ") does not exist!" << std::endl;
+            return 0.0;
         }
 
-        mutex.unlock();
+        uint32_t firstBlock = startPosition / analysisOptions.hopSize;
+        uint32_t endBlock = (endPosition - 1) / analysisOptions.hopSize + 1;
+        std::call_once(energyPrefixOnce, &LarmorSound::computeEnergyPrefix, this);
+        if (energy_prefix == NULL) {
+            return 0.0;
+        }
+        const double *prefix = energy_prefix->row(numChannel, 0);
+        return prefix[endBlock] - prefix[firstBlock];
     }
 
-    bool LarmorSound::isHeartbeatActive() {
+    smpl_t LarmorSound::getChannelEnergyAverage(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0.0;
+        }
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return 0.0;
+        }
+        if (!loadComplete) {
+            std::cout << "LarmorSound:: error: range queries need the complete loading!" << std::endl;
+            return 0.0;
+        }
+        if (startPosition >= endPosition || endPosition > numSamples) {
+            std::cout << "LarmorSound:: error range: [" << startPosition << ", " << endPosition << ") does not exist!" << std::endl;
+            return 0.0;
+        }
+
+        uint32_t firstBlock = startPosition / analysisOptions.hopSize;
+        uint32_t endBlock = (endPosition - 1) / analysisOptions.hopSize + 1;
+        std::call_once(energyPrefixOnce, &LarmorSound::computeEnergyPrefix, this);
+        if (energy_prefix == NULL) {
+            return 0.0;
+        }
+        const double *prefix = energy_prefix->row(numChannel, 0);
+        return (prefix[endBlock] - prefix[firstBlock]) / (endBlock - firstBlock);
+    }
+
+    bool LarmorSound::getChannelSpectrumAverage(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition,
+        vect_smpl &spectrum)
+    {
         if (!initedCreation) {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
             return false;
         }
-        bool result = false;
-        mutex.lock();
+        if (numChannel >= numChannels) {
+            std::cout << "LarmorSound:: error channel: " << numChannel << " does not exist!" << std::endl;
+            return false;
+        }
+        if (!loadComplete) {
+            std::cout << "LarmorSound:: error: range queries need the complete loading!" << std::endl;
+            return false;
+        }
+        if (startPosition >= endPosition || endPosition > numSamples) {
+            std::cout << "LarmorSound:: error range: [" << startPosition << ", " << endPosition << ") does not exist!" << std::endl;
+            return false;
+        }
 
-        result = heartbeatActive;
+        std::call_once(spectrumPrefixOnce, &LarmorSound::computeSpectrumPrefix, this);
+        if (spectrum_prefix == NULL) {
+            return false;
+        }
 
-        mutex.unlock();
-        return result;
+        uint32_t firstBlock = startPosition / analysisOptions.hopSize;
+        uint32_t endBlock = (endPosition - 1) / analysisOptions.hopSize + 1;
+        const double *first = spectrum_prefix->row(numChannel, firstBlock);
+        const double *end = spectrum_prefix->row(numChannel, endBlock);
+        uint32_t bins = spectrum_prefix->getRowSize();
+        double numBlocks = endBlock - firstBlock;
+        spectrum.resize(bins);
+        for (uint32_t j = 0; j < bins; j++)
+        {
+            spectrum[j] = (end[j] - first[j]) / numBlocks;
+        }
+        return true;
+    }
+
+    // Prefix sums of the block energies: energy_prefix[b] is the energy of the blocks before b.
+    //  Built at loading, or on the first range query with the lazy analysis
+    void LarmorSound::computeEnergyPrefix()
+    {
+        if (lazyAnalysis != NULL) {
+            lazyAnalysis->ensureAll();
+        }
+        uint32_t blocks = energy_samples->getNumRows();
+        energy_prefix = newArena<double>(numChannels, 1, analysisOptions.mappedStorage);
+        if (!energy_prefix->resize(blocks + 1)) {
+            std::cout << "LarmorSound:: Error: could not allocate the energy prefix sums!" << std::endl;
+            delete energy_prefix;
+            energy_prefix = NULL;
+            return;
+        }
+        for (uint8_t channel = 0; channel < numChannels; channel++)
+        {
+            double *prefix = energy_prefix->row(channel, 0);
+            prefix[0] = 0.0;
+            for (uint32_t b = 0; b < blocks; b++)
+            {
+                prefix[b + 1] = prefix[b] + *energy_samples->row(channel, b);
+            }
+        }
+    }
+
+    // Maps a valid cache file and points the arenas into it
+    bool LarmorSound::loadAnalysisCache(const std::string &cachePath, const AnalysisCacheKey &cacheKey)
+    {
+        analysisCache = AnalysisCache::load(cachePath, cacheKey);
+        if (analysisCache == NULL) {
+            return false;
+        }
+        const AnalysisCacheHeader &header = analysisCache->getHeader();
+        numSamples = header.numSamples;
+        samplerate = header.samplerate;
+        numChannels = header.numChannels;
+        analysisOptions.fftSize = header.fftSize;
+        analysisOptions.hopSize = header.hopSize;
+        analysisOptions.window = (WindowType)header.windowType;
+        analysisOptions.spectrumMode = (SpectrumMode)header.spectrumMode;
+        analysisOptions.spectrumStorage = (SpectrumStorage)header.spectrumStorage;
+        analysisOptions.spectrumScale = (SpectrumScale)header.spectrumScale;
+        analysisOptions.spectrumRangeDb = header.spectrumRangeDb;
+        analysisOptions.sampleStorage = (SampleStorage)header.sampleStorage;
+
+        if (analysisOptions.sampleStorage == SAMPLE_STORAGE_INT16) {
+            channels_pcm = new ChannelArena<int16_t>(numChannels, 1);
+            analysisCache->attach(header.samplesOffset, header.numSamples, *channels_pcm);
+        } else {
+            channels_samples = new ChannelArena<smpl_t>(numChannels, 1);
+            analysisCache->attach(header.samplesOffset, header.numSamples, *channels_samples);
+        }
+        if (analysisOptions.spectrumStorage != SPECTRUM_STORAGE_FLOAT) {
+            spectrum_codes = new ChannelArena<uint8_t>(numChannels,
+                SpectrumQuantizer(analysisOptions).getRowBytes(header.numBins));
+            analysisCache->attach(header.spectrumOffset, header.numBlocks, *spectrum_codes);
+        } else {
+            spectrum_samples = new ChannelArena<smpl_t>(numChannels, header.numBins);
+            analysisCache->attach(header.spectrumOffset, header.numBlocks, *spectrum_samples);
+        }
+        energy_samples = new ChannelArena<smpl_t>(numChannels, 1);
+        analysisCache->attach(header.energyOffset, header.numBlocks, *energy_samples);
+        rms_samples = new ChannelArena<smpl_t>(numChannels, 1);
+        analysisCache->attach(header.rmsOffset, header.numBlocks, *rms_samples);
+        peak_samples = new ChannelArena<smpl_t>(numChannels, 1);
+        analysisCache->attach(header.peakOffset, header.numBlocks, *peak_samples);
+        std::call_once(energyPrefixOnce, &LarmorSound::computeEnergyPrefix, this);
+
+        std::cout << "LarmorSound:: read " << (numSamples * 1.0 / samplerate)
+            << "s (" << numSamples
+            << " samples in " << header.numBlocks
+            << " frames of " << header.fftSize
+            << " hop " << header.hopSize
+            << ") from analysis cache " << cachePath
+            << " at " << samplerate << "Hz" << std::endl;
+        return true;
+    }
+
+    void LarmorSound::setCacheActive(bool active, const char *cacheDirectoryParam)
+    {
+        std::lock_guard<std::mutex> lock(cacheConfigMutex);
+        cacheActive = active;
+        cacheDirectory = cacheDirectoryParam != NULL ? cacheDirectoryParam : "";
+    }
+
+    void LarmorSound::setMappedStorageDirectory(const char *directory)
+    {
+        std::lock_guard<std::mutex> lock(storageConfigMutex);
+        mappedStorageDirectory = directory != NULL ? directory : "";
+    }
+
+    void LarmorSound::setAssetCacheActive(bool active, uint64_t memoryBudgetBytes)
+    {
+        AssetCache::configure(active, memoryBudgetBytes);
+    }
+
+    AssetCacheStats LarmorSound::getAssetCacheStats()
+    {
+        return AssetCache::getStats();
+    }
+
+    bool LarmorSound::isCacheActive()
+    {
+        std::lock_guard<std::mutex> lock(cacheConfigMutex);
+        return cacheActive;
+    }
+
+    // Prefix sums of the spectra per bin: spectrum_prefix[b][j] is the sum of the bin j
+    //  of the blocks before b. It doubles the spectrum memory, so it is built only
+    //  on the first call of getChannelSpectrumAverage
+    void LarmorSound::computeSpectrumPrefix()
+    {
+        if (lazyAnalysis != NULL) {
+            lazyAnalysis->ensureAll();
+        }
+        uint32_t blocks = energy_samples->getNumRows();
+        uint32_t bins = analysisOptions.fftSize / 2 + 1;
+        spectrum_prefix = newArena<double>(numChannels, bins, analysisOptions.mappedStorage);
+        if (!spectrum_prefix->resize(blocks + 1)) {
+            std::cout << "LarmorSound:: Error: could not allocate the spectrum prefix sums!" << std::endl;
+            delete spectrum_prefix;
+            spectrum_prefix = NULL;
+            return;
+        }
+        vect_smpl spectrum(bins);
+        for (uint8_t channel = 0; channel < numChannels; channel++)
+        {
+            // row 0 is already zero
+            for (uint32_t b = 0; b < blocks; b++)
+            {
+                const double *previous = spectrum_prefix->row(channel, b);
+                readSpectrumRow(channel, b, &spectrum[0]);
+                double *prefix = spectrum_prefix->row(channel, b + 1);
+                for (uint32_t j = 0; j < bins; j++)
+                {
+                    prefix[j] = previous[j] + spectrum[j];
+                }
+            }
+        }
+    }
+
+    // Copies the spectrum of a block in values, decoding the quantized storage
+    void LarmorSound::readSpectrumRow(uint8_t numChannel, uint32_t block, smpl_t *values)
+    {
+        uint32_t bins = analysisOptions.fftSize / 2 + 1;
+        if (spectrum_codes != NULL) {
+            SpectrumQuantizer(analysisOptions).dequantize(spectrum_codes->row(numChannel, block), bins, values);
+        } else {
+            memcpy(values, spectrum_samples->row(numChannel, block), bins * sizeof(smpl_t));
+        }
+    }
+
+    void LarmorSound::ensureBlock(uint32_t block)
+    {
+        if (lazyAnalysis != NULL) {
+            lazyAnalysis->ensure(block);
+        }
+    }
+
+    // Sizes the block arenas for the read samples and starts the lazy analysis, the
+    //  samples are published after it so the getters always find it
+    bool LarmorSound::startLazyAnalysis(uint32_t totalRead, const vect_smpl &window)
+    {
+        uint32_t blocks = totalRead / analysisOptions.hopSize + 1;
+        bool sized = spectrum_codes != NULL ? spectrum_codes->resize(blocks) : spectrum_samples->resize(blocks);
+        sized = sized && energy_samples->resize(blocks) && rms_samples->resize(blocks) && peak_samples->resize(blocks);
+        if (!sized) {
+            std::cout << "LarmorSound:: Error: could not allocate the storage of " << blocks << " frames!" << std::endl;
+            return false;
+        }
+        lazyAnalysis = new LazyAnalysis(channels_samples, channels_pcm, spectrum_samples, spectrum_codes,
+            *energy_samples, *rms_samples, *peak_samples, totalRead, analysisOptions, window,
+            selectSpectrumKernel(analysisOptions.spectrumMode), playPosition);
+        if (!lazyAnalysis->isValid()) {
+            std::cout << "LarmorSound:: Error: could not create fft object!" << std::endl;
+            delete lazyAnalysis;
+            lazyAnalysis = NULL;
+            return false;
+        }
+        lazyAnalysis->startPrefetch();
+        if (loadProgress != NULL) {
+            loadProgress->blocksTotal = blocks;
+            loadProgress->blocksDone = blocks;
+        }
+        numSamples.store(totalRead, std::memory_order_release);
+        loadComplete = true;
+        loadStatus = LOAD_OK;
+        initedCreation = true;
+        return true;
+    }
+
+    uint32_t LarmorSound::getNumAnalyzedFrames()
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0;
+        }
+        if (lazyAnalysis != NULL) {
+            return lazyAnalysis->getNumReady();
+        }
+        uint32_t frames = energy_samples->getNumRows();
+        if (!loadComplete) {
+            // The blocks are stored out of order: only the frames below the watermark are complete
+            uint32_t ready = numSamples.load(std::memory_order_acquire);
+            uint32_t hop = analysisOptions.hopSize;
+            frames = std::min(frames, (uint32_t)(((uint64_t)ready + hop - 1) / hop));
+        }
+        return frames;
+    }
+
+    AnalysisOptions LarmorSound::getAnalysisOptions()
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+        }
+        return analysisOptions;
+    }
+
+    LoadStatus LarmorSound::getLoadStatus()
+    {
+        return loadStatus;
+    }
+
+    bool LarmorSound::isLoadComplete()
+    {
+        return loadComplete;
+    }
+
+    LoadTimings LarmorSound::getLoadTimings()
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+        }
+        return loadTimings;
+    }
+
+    void LarmorSound::setHeartbeatActive(bool active, uint64_t heartbeatThresholdParam) {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return;
+        }
+        if (heartbeatThresholdParam != 0) {
+            heartbeatThreshold = heartbeatThresholdParam;
+        }
+        heartbeatActive = active;
+    }
+
+    bool LarmorSound::isHeartbeatActive() {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return false;
+        }
+        return heartbeatActive;
     }
 
     void LarmorSound::heartbeat()
     {
-        mutex.lock();
         if (playing && heartbeatActive) {
-            heartbeatLast = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
-            // Prevent SDL race condition issue
-            if (SDL_GetAudioStatus() != SDL_AUDIO_PLAYING) {
-                SDL_PauseAudio(0);
-            }
+            heartbeatLast = heartbeatNowMs();
             //std::cout << "heartbeatLast:: " << heartbeatLast << std::endl;
         }
-        mutex.unlock();
+    }
+
+    uint64_t LarmorSound::heartbeatNowMs()
+    {
+        if (renderOutput) {
+            return renderTimeNs / 1000000;
+        }
+        return std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    }
+
+    // Queues a command for the audio callback, the caller holds mutex
+    bool LarmorSound::pushPlaybackCommand(uint8_t type, uint32_t position)
+    {
+        PlaybackCommand command;
+        command.type = type;
+        command.position = position;
+        if (!playbackCommands->push(command)) {
+            std::cout << "LarmorSound:: error: too many pending playback commands!" << std::endl;
+            return false;
+        }
+        return true;
     }
 
     void LarmorSound::forwardSDLCallback(void *userdata, Uint8 *stream, int len)
@@ -305,74 +1535,160 @@ namespace Larmor {
 
     void LarmorSound::memberSDLCallback(Uint8 *stream, int len)
     {
-        mutex.lock();
-        //std::cout << "playPosition:"<< playPosition << std::endl;
+        int64_t callbackTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        float *audio_pos = reinterpret_cast<float *>(stream);
+        uint32_t written = renderPlayback(audio_pos, len / (sizeof(float) * numChannels), callbackTimeNs);
+        float gain = playbackGain;
+        if (written > 0 && gain != 1.0f) {
+            getMixKernels().gain(audio_pos, gain, audio_pos, written * numChannels);
+        }
+    }
+
+    // Audio thread: it never takes a lock, so the API threads cannot delay the audio.
+    //  The callback is the only one advancing playPosition; the API threads store the requested
+    //  state for their readers and the callback applies the queued commands in order, so a
+    //  concurrent callback can show a stale state at most until the next one.
+    //  Writes frames interleaved AUDIO_F32 frames in out, returns the frames of the track
+    //  written, the rest is silence
+    uint32_t LarmorSound::renderPlayback(float *out, uint32_t frames, int64_t callbackTimeNs)
+    {
+        bool active = playing;
+        uint32_t position = playPosition;
+        //std::cout << "playPosition:"<< position << std::endl;
+        size_t len = (size_t)frames * numChannels * sizeof(float);
+
+        PlaybackCommand command;
+        bool applied = false;
+        while (playbackCommands->pop(command))
+        {
+            if (command.type == PLAYBACK_COMMAND_PLAY) {
+                active = true;
+                if (command.position != PLAYBACK_POSITION_CURRENT) {
+                    position = command.position;
+                }
+            } else {
+                active = false;
+            }
+            applied = true;
+        }
+        if (applied) {
+            playPosition = position;
+            playing = active;
+        }
+
+        if (!active) {
+            memset(out, 0, len); // silence when not playing
+            publishPlaybackClock(position, 0, callbackTimeNs);
+            return 0;
+        }
 
-        // check if nowheartbeat - heartbeatLast > heartbeatThreshold then pause(1) else pause(0)
+        // if nowheartbeat - heartbeatLast > heartbeatThreshold then play silence, the position does not move
         if (heartbeatActive) {
-            uint64_t heartbeatNow= std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+            uint64_t heartbeatNow = heartbeatNowMs();
             //std::cout << "heartbeat elapesed:: " << (heartbeatNow - heartbeatLast) << std::endl;
             if ( (heartbeatNow - heartbeatLast) > heartbeatThreshold ) {
-                if (SDL_GetAudioStatus() == SDL_AUDIO_PLAYING) {
-                    SDL_PauseAudio(1); //Stop
-                }
-                mutex.unlock();
                 //std::cout << "STOP" << std::endl;
-                return;
-            } else {
-                if (SDL_GetAudioStatus() != SDL_AUDIO_PLAYING) {
-                    SDL_PauseAudio(0); //Continue
-                }
-                //std::cout << "PLAY" << std::endl;
+                memset(out, 0, len);
+                publishPlaybackClock(position, 0, callbackTimeNs);
+                return 0;
             }
         }
 
-        if (playPosition >= numSamples) {
-            playing = false;
-            SDL_PauseAudio(1);
-            mutex.unlock();
-            return;
+        // The samples up to the watermark are ready: while loading, reaching it is an underrun
+        //  that plays silence and keeps the position, at the end of the track the playback stops
+        uint32_t ready = numSamples.load(std::memory_order_acquire);
+        if (position >= ready) {
+            if (loadComplete) {
+                playing = false;
+            }
+            memset(out, 0, len);
+            publishPlaybackClock(position, 0, callbackTimeNs);
+            return 0;
         }
 
-        // divide 4 because float is 4 bytes, I should use sizeof for best portability
-        float *audio_pos = new float[len / 4 * numChannels]; //tracks_sample.size()
-        Uint32 idx = 0;
-        for (Uint32 i = 0; i < len / 4 / numChannels; i++) // loop per samples
-        {
+        // The channels are interleaved: one bounds check per buffer,
+        //  then the samples are copied straight in out, nothing is allocated
+        uint32_t available = std::min(frames, ready - position);
+        if (playbackInterleaved != NULL) {
+            memcpy(out, playbackInterleaved + (size_t)position * numChannels,
+                (size_t)available * numChannels * sizeof(float));
+        } else if (channels_pcm != NULL) {
+            // int16 storage: only the samples of this buffer are decoded
             for (uint8_t c = 0; c < numChannels; c++) // loop per channels
             {
-                if ((playPosition + i) < numSamples) {
-                    audio_pos[idx++] = channels_samples[c][playPosition + i];
-                } else {
-                    audio_pos[idx++] = 0.0; //if out of vector element, put 0 values
+                const int16_t *samples = channels_pcm->row(c, position);
+                for (uint32_t i = 0; i < available; i++) // loop per samples
+                {
+                    out[i * numChannels + c] = samples[i] * (1.0f / PCM_INT16_SCALE);
+                }
+            }
+        } else {
+            for (uint8_t c = 0; c < numChannels; c++) // loop per channels
+            {
+                const smpl_t *samples = channels_samples->row(c, position);
+                for (uint32_t i = 0; i < available; i++) // loop per samples
+                {
+                    out[i * numChannels + c] = samples[i];
                 }
             }
         }
+        // after the end of the track put 0 values
+        memset(out + (size_t)available * numChannels, 0, len - (size_t)available * numChannels * sizeof(float));
+        publishPlaybackClock(position, available, callbackTimeNs);
 
-        //if you want to use the following line then you have to comment 2 lines following
-        //SDL_memcpy (stream, (uint8_t *)audio_pos, len); // simply copy from one buffer into the other
-        memset(stream, 0, len); // clear buffer
-        SDL_MixAudio(stream, (uint8_t *)audio_pos, len, SDL_MIX_MAXVOLUME); // mix from one buffer into another
+        position += available;
+        playPosition = position;
 
-        len = (numSamples - playPosition) > (len / 4 / numChannels) ? len : ((numSamples - playPosition) * 4 * numChannels);
-        playPosition += len / 4 / numChannels;
-
-        delete[] audio_pos;
-
-        if (playPosition >= numSamples) {
+        if (position >= numSamples && loadComplete) {
             playing = false;
-            SDL_PauseAudio(1);
         }
+        return available;
+    }
 
-        mutex.unlock();
+    // Audio thread: publishes the buffer written at callbackTimeNs for getPlaybackClockPosition.
+    //  Seqlock: the sequence is odd while the fields are written, the readers retry on change
+    void LarmorSound::publishPlaybackClock(uint32_t position, uint32_t frames, int64_t callbackTimeNs)
+    {
+        // The device consumes the buffers at the nominal rate while the callbacks are scheduled
+        //  with jitter: when this buffer follows the previous one, the time is moved toward the
+        //  expected one, so the extrapolation does not jump back at a late callback.
+        //  Only this thread writes the clock fields, so it reads them back without the seqlock
+        int64_t previousNs = clockTimeNs.load(std::memory_order_relaxed);
+        uint32_t previousFrames = clockFrames.load(std::memory_order_relaxed);
+        if (previousNs != 0 && previousFrames > 0 && frames > 0
+            && position == clockPosition.load(std::memory_order_relaxed) + previousFrames) {
+            int64_t expectedNs = previousNs + (int64_t)previousFrames * 1000000000 / playbackSpec.freq;
+            int64_t errorNs = callbackTimeNs - expectedNs;
+            if (std::abs(errorNs) < (int64_t)(playbackSpec.bufferSeconds * 1e9)) {
+                callbackTimeNs = expectedNs + errorNs / PLAYBACK_CLOCK_SMOOTHING;
+            }
+        }
+
+        uint32_t sequence = clockSequence.load(std::memory_order_relaxed);
+        clockSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        clockPosition.store(position, std::memory_order_relaxed);
+        clockFrames.store(frames, std::memory_order_relaxed);
+        clockTimeNs.store(callbackTimeNs, std::memory_order_relaxed);
+        clockSequence.store(sequence + 2, std::memory_order_release);
     }
 
-    bool LarmorSound::initPlay()
+    bool LarmorSound::initPlay(PlaybackMode mode, uint16_t bufferFrames)
     {
         if (!initedCreation) {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
             return false;
         }
+        if (initedPlay) {
+            std::cout << "LarmorSound:: error: playback already initialized, call closePlay first!" << std::endl;
+            return false;
+        }
+        if (bufferFrames < PLAYBACK_BUFFER_FRAMES_MIN || (bufferFrames & (bufferFrames - 1)) != 0) {
+            std::cout << "LarmorSound:: error bufferFrames: " << bufferFrames << " must be a power of 2 not less than "
+                << PLAYBACK_BUFFER_FRAMES_MIN << "!" << std::endl;
+            return false;
+        }
 
         mutex.lock();
 
@@ -390,7 +1706,7 @@ namespace Larmor {
         want.freq = samplerate;
         want.format = AUDIO_F32;
         want.channels = numChannels;
-        want.samples = 4096;
+        want.samples = bufferFrames;
         want.callback = LarmorSound::forwardSDLCallback;
         want.userdata = this;
 
@@ -400,15 +1716,395 @@ namespace Larmor {
             return false;
         } else if (have.format != want.format) {
                 std::cout << "LarmorSound:: Error: not AUDIO_F32 audio format available!" << std::endl;
+                SDL_CloseAudio();
+                mutex.unlock();
+                return false;
+        } else if (have.freq != want.freq || have.channels != want.channels) {
+                std::cout << "LarmorSound:: Error: audio device opened at " << have.freq << "Hz with "
+                    << (int)have.channels << " channels instead of " << want.freq << "Hz with "
+                    << (int)want.channels << " channels!" << std::endl;
+                SDL_CloseAudio();
                 mutex.unlock();
                 return false;
         }
 
+        // The device buffer size can differ from the requested one
+        playbackSpec.freq = have.freq;
+        playbackSpec.format = have.format;
+        playbackSpec.channels = have.channels;
+        playbackSpec.samples = have.samples;
+        playbackSpec.size = have.size;
+        playbackSpec.bufferSeconds = have.samples * 1.0 / have.freq;
+        playbackSpec.latencySeconds = playbackSpec.bufferSeconds * PLAYBACK_LATENCY_BUFFERS;
+        std::cout << "LarmorSound:: audio device: " << have.freq << "Hz, " << (int)have.channels
+            << " channels, buffer " << have.samples << " frames, estimated latency "
+            << playbackSpec.latencySeconds * 1000.0 << "ms" << std::endl;
+
+        preparePlayback(mode);
+        playPosition = 0;
+        playing = false;
+        initedPlay = true;
+
+        mutex.unlock();
+        return true;
+    }
+
+    void LarmorSound::preparePlayback(PlaybackMode mode)
+    {
+        // Source of the interleaved playback: the samples themselves for a mono track,
+        //  a copy in the device layout built here for PLAYBACK_INTERLEAVED
+        playbackInterleaved = NULL;
+        if (!loadComplete) {
+            // The samples arena can still grow, the callback reads it through the watermark
+            if (mode == PLAYBACK_INTERLEAVED) {
+                std::cout << "LarmorSound:: loading in progress, PLAYBACK_DIRECT used" << std::endl;
+            }
+        } else if (channels_pcm != NULL) {
+            // The callback decodes the int16 samples it plays, a float copy would undo the saving
+            if (mode == PLAYBACK_INTERLEAVED) {
+                std::cout << "LarmorSound:: samples stored as int16, PLAYBACK_DIRECT used" << std::endl;
+            }
+        } else if (numChannels == 1) {
+            playbackInterleaved = channels_samples->row(0, 0);
+        } else if (mode == PLAYBACK_INTERLEAVED && (uint64_t)numSamples * numChannels > UINT32_MAX) {
+            // The rows of an arena are counted in 32 bit
+            std::cout << "LarmorSound:: track too long for an interleaved copy, PLAYBACK_DIRECT used" << std::endl;
+        } else if (mode == PLAYBACK_INTERLEAVED) {
+            if (interleaved_samples == NULL) {
+                interleaved_samples = newArena<smpl_t>(1, 1, analysisOptions.mappedStorage);
+                if (interleaved_samples->resize(numSamples * numChannels)) {
+                    smpl_t *interleaved = interleaved_samples->row(0, 0);
+                    for (uint8_t c = 0; c < numChannels; c++)
+                    {
+                        const smpl_t *samples = channels_samples->row(c, 0);
+                        for (uint32_t i = 0; i < numSamples; i++)
+                        {
+                            interleaved[(size_t)i * numChannels + c] = samples[i];
+                        }
+                    }
+                } else {
+                    std::cout << "LarmorSound:: could not allocate the interleaved copy, PLAYBACK_DIRECT used" << std::endl;
+                    delete interleaved_samples;
+                    interleaved_samples = NULL;
+                }
+            }
+            if (interleaved_samples != NULL) {
+                playbackInterleaved = interleaved_samples->row(0, 0);
+            }
+        }
+
+        // Out of core storage: the pages ahead of the play position are read in advance,
+        //  the arenas do not grow any more once the loading is complete
+        bool mapped = channels_pcm != NULL ? channels_pcm->isMapped() : channels_samples->isMapped();
+        if (readahead == NULL && loadComplete && mapped) {
+            readahead = new MappedReadahead(playPosition, numSamples, samplerate * MAPPED_READAHEAD_SECONDS,
+                [this](uint32_t firstSample, uint32_t samples) { adviseReadahead(firstSample, samples); });
+        }
+
+        playbackCommands->clear(); // the callback is not running yet
+        publishPlaybackClock(0, 0, 0);
+    }
+
+    // Readahead thread: hints the rows of the samples and of their blocks in the mapped arenas
+    void LarmorSound::adviseReadahead(uint32_t firstSample, uint32_t samples)
+    {
+        if (channels_pcm != NULL) {
+            channels_pcm->willNeed(firstSample, samples);
+        } else {
+            channels_samples->willNeed(firstSample, samples);
+        }
+        if (interleaved_samples != NULL) {
+            // The interleaved copy has at most UINT32_MAX rows, willNeed clips the count
+            uint64_t firstRow = (uint64_t)firstSample * numChannels;
+            uint64_t rows = (uint64_t)samples * numChannels;
+            if (firstRow < interleaved_samples->getNumRows()) {
+                interleaved_samples->willNeed(firstRow, std::min(rows, (uint64_t)UINT32_MAX));
+            }
+        }
+        uint32_t hop = analysisOptions.hopSize;
+        uint32_t firstBlock = firstSample / hop;
+        uint32_t blocks = (firstSample + samples) / hop - firstBlock + 1;
+        if (spectrum_samples != NULL) {
+            spectrum_samples->willNeed(firstBlock, blocks);
+        }
+        if (spectrum_codes != NULL) {
+            spectrum_codes->willNeed(firstBlock, blocks);
+        }
+        energy_samples->willNeed(firstBlock, blocks);
+        rms_samples->willNeed(firstBlock, blocks);
+        peak_samples->willNeed(firstBlock, blocks);
+    }
+
+    bool LarmorSound::initMixerPlay(PlaybackMode mode)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            mixerStatus = MIXER_ERROR_STATE;
+            return false;
+        }
+
+        mutex.lock();
+        if (initedPlay) {
+            std::cout << "LarmorSound:: error: playback already initialized, call closePlay first!" << std::endl;
+            mixerStatus = MIXER_ERROR_STATE;
+            mutex.unlock();
+            return false;
+        }
+
+        // The voice must be ready before the mixer callback can see it
+        preparePlayback(mode);
+        playPosition = 0;
+        playing = false;
+
+        mixerStatus = MIXER_ERROR_DEVICE;
+        {
+            std::lock_guard<std::mutex> lock(mixerMutex);
+            if (sharedMixer == NULL) {
+                sharedMixer = AudioMixer::open(samplerate, numChannels, PLAYBACK_BUFFER_FRAMES_DEFAULT);
+            }
+            if (sharedMixer != NULL) {
+                playbackSpec = sharedMixer->getSpec();
+                mixerStatus = sharedMixer->addVoice(this);
+            }
+        }
+
+        bool result = (mixerStatus == MIXER_OK);
+        if (result) {
+            mixerVoice = true;
+            initedPlay = true;
+        } else {
+            delete readahead;
+            readahead = NULL;
+            playbackInterleaved = NULL;
+            delete interleaved_samples;
+            interleaved_samples = NULL;
+        }
+        mutex.unlock();
+        return result;
+    }
+
+    MixerStatus LarmorSound::getMixerStatus()
+    {
+        return mixerStatus;
+    }
+
+    bool LarmorSound::openMixer(uint32_t samplerate, uint8_t channels, uint16_t bufferFrames)
+    {
+        if (bufferFrames < PLAYBACK_BUFFER_FRAMES_MIN || (bufferFrames & (bufferFrames - 1)) != 0) {
+            std::cout << "LarmorSound:: error bufferFrames: " << bufferFrames << " must be a power of 2 not less than "
+                << PLAYBACK_BUFFER_FRAMES_MIN << "!" << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mixerMutex);
+        if (sharedMixer != NULL) {
+            std::cout << "LarmorSound:: error: the mixer is already open!" << std::endl;
+            return false;
+        }
+        sharedMixer = AudioMixer::open(samplerate, channels, bufferFrames);
+        return sharedMixer != NULL;
+    }
+
+    bool LarmorSound::closeMixer()
+    {
+        std::lock_guard<std::mutex> lock(mixerMutex);
+        if (sharedMixer == NULL) {
+            std::cout << "LarmorSound:: error: the mixer is not open, nothing to do!" << std::endl;
+            return false;
+        }
+        if (sharedMixer->getNumVoices() > 0) {
+            std::cout << "LarmorSound:: error: the mixer is playing " << sharedMixer->getNumVoices()
+                << " voices, call closePlay on them first!" << std::endl;
+            return false;
+        }
+        delete sharedMixer;
+        sharedMixer = NULL;
+        return true;
+    }
+
+    void LarmorSound::setPlaybackGain(smpl_t gain)
+    {
+        playbackGain = gain;
+    }
+
+    smpl_t LarmorSound::getPlaybackGain()
+    {
+        return playbackGain;
+    }
+
+    bool LarmorSound::initRenderPlay(PlaybackMode mode, uint16_t bufferFrames)
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return false;
+        }
+        if (bufferFrames < PLAYBACK_BUFFER_FRAMES_MIN || (bufferFrames & (bufferFrames - 1)) != 0) {
+            std::cout << "LarmorSound:: error bufferFrames: " << bufferFrames << " must be a power of 2 not less than "
+                << PLAYBACK_BUFFER_FRAMES_MIN << "!" << std::endl;
+            return false;
+        }
+
+        mutex.lock();
+        if (initedPlay) {
+            std::cout << "LarmorSound:: error: playback already initialized, call closePlay first!" << std::endl;
+            mutex.unlock();
+            return false;
+        }
+
+        // The spec of a device that would play the track as it is, with no output latency
+        playbackSpec.freq = samplerate;
+        playbackSpec.format = AUDIO_F32;
+        playbackSpec.channels = numChannels;
+        playbackSpec.samples = bufferFrames;
+        playbackSpec.size = bufferFrames * numChannels * sizeof(float);
+        playbackSpec.bufferSeconds = bufferFrames * 1.0 / samplerate;
+        playbackSpec.latencySeconds = 0.0;
+
+        preparePlayback(mode);
+        memset(&renderStats, 0, sizeof(renderStats));
+        renderTimeNs = RENDER_CLOCK_START_NS;
         playPosition = 0;
         playing = false;
+        renderOutput = true;
         initedPlay = true;
 
         mutex.unlock();
+        return true;
+    }
+
+    // The caller is the audio thread: as the callback it takes no lock, so render is called
+    //  by one thread at a time
+    uint32_t LarmorSound::render(float *out, uint32_t frames)
+    {
+        if (!initedPlay || !renderOutput) {
+            std::cout << "LarmorSound:: error: LarmorSound::initRenderPlay has not been called, nothing to do!" << std::endl;
+            return 0;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint32_t written = 0;
+        uint32_t offset = 0;
+        while (offset < frames)
+        {
+            uint32_t part = std::min(frames - offset, (uint32_t)playbackSpec.samples);
+            float *partOut = out + (size_t)offset * numChannels;
+            uint32_t partWritten = renderPlayback(partOut, part, renderTimeNs);
+            float gain = playbackGain;
+            if (partWritten > 0 && gain != 1.0f) {
+                getMixKernels().gain(partOut, gain, partOut, partWritten * numChannels);
+            }
+            written += partWritten;
+            offset += part;
+            // From the frame count, so the virtual time does not drift with rounding
+            renderStats.frames += part;
+            renderTimeNs = RENDER_CLOCK_START_NS + (int64_t)(renderStats.frames * 1000000000ULL / samplerate);
+        }
+        renderStats.renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return written;
+    }
+
+    // Little endian field of the WAV header
+    static bool writeWavField(FILE *file, uint32_t value, uint8_t bytes)
+    {
+        uint8_t field[4];
+        for (uint8_t i = 0; i < bytes; i++)
+        {
+            field[i] = (value >> (8 * i)) & 0xff;
+        }
+        return fwrite(field, 1, bytes, file) == bytes;
+    }
+
+    // Frames of numChannels float samples that fit in the 32 bit sizes of a RIFF header
+    static uint32_t wavMaxFrames(uint8_t numChannels)
+    {
+        return (UINT32_MAX - 36) / (numChannels * sizeof(float));
+    }
+
+    static bool writeWavHeader(FILE *file, uint32_t samplerate, uint8_t numChannels, uint32_t frames)
+    {
+        if (frames > wavMaxFrames(numChannels)) {
+            return false;
+        }
+        uint32_t dataBytes = frames * numChannels * sizeof(float);
+        return fwrite("RIFF", 1, 4, file) == 4
+            && writeWavField(file, 36 + dataBytes, 4)
+            && fwrite("WAVEfmt ", 1, 8, file) == 8
+            && writeWavField(file, 16, 4)
+            && writeWavField(file, 3, 2) // WAVE_FORMAT_IEEE_FLOAT
+            && writeWavField(file, numChannels, 2)
+            && writeWavField(file, samplerate, 4)
+            && writeWavField(file, samplerate * numChannels * sizeof(float), 4)
+            && writeWavField(file, numChannels * sizeof(float), 2)
+            && writeWavField(file, 32, 2)
+            && fwrite("data", 1, 4, file) == 4
+            && writeWavField(file, dataBytes, 4);
+    }
+
+    bool LarmorSound::renderToWav(const char *filename, uint32_t maxFrames)
+    {
+        if (!initedPlay || !renderOutput) {
+            std::cout << "LarmorSound:: error: LarmorSound::initRenderPlay has not been called, nothing to do!" << std::endl;
+            return false;
+        }
+        FILE *file = fopen(filename, "wb");
+        if (file == NULL) {
+            std::cout << "LarmorSound:: error: could not open " << filename << " for writing!" << std::endl;
+            return false;
+        }
+
+        // Header rewritten with the final size at the end
+        bool result = writeWavHeader(file, samplerate, numChannels, 0);
+        std::vector<float> buffer((size_t)playbackSpec.samples * numChannels);
+        uint32_t total = 0;
+        uint32_t wav_max_frames = wavMaxFrames(numChannels);
+        bool too_long = false;
+        while (result && (maxFrames == 0 || total < maxFrames))
+        {
+            uint32_t frames = playbackSpec.samples;
+            if (maxFrames != 0) {
+                frames = std::min(frames, maxFrames - total);
+            }
+            uint32_t written = render(&buffer[0], frames);
+            if (maxFrames == 0) {
+                // Without a limit only the frames of the track are kept
+                frames = written;
+            }
+            if (frames > wav_max_frames - total) {
+                // The rest does not fit the WAV sizes: the file keeps the frames that do
+                frames = wav_max_frames - total;
+                too_long = true;
+            }
+            size_t values = (size_t)frames * numChannels;
+            result = fwrite(&buffer[0], sizeof(float), values, file) == values;
+            total += frames;
+            if (too_long || (maxFrames == 0 && (written == 0 || !playing))) {
+                break;
+            }
+        }
+        result = result && fseek(file, 0, SEEK_SET) == 0 && writeWavHeader(file, samplerate, numChannels, total);
+        result = (fclose(file) == 0) && result;
+        if (too_long) {
+            std::cout << "LarmorSound:: error: the rendering exceeds the 4 GiB of a WAV file, " << filename
+                << " is truncated at " << total << " frames!" << std::endl;
+            return false;
+        }
+        if (!result) {
+            std::cout << "LarmorSound:: error: could not write " << filename << "!" << std::endl;
+        }
+        return result;
+    }
+
+    int64_t LarmorSound::getRenderTimeNs()
+    {
+        return renderTimeNs;
+    }
+
+    RenderStats LarmorSound::getRenderStats()
+    {
+        RenderStats result = renderStats;
+        if (result.renderSeconds > 0.0) {
+            result.framesPerSecond = result.frames / result.renderSeconds;
+            result.realtimeFactor = result.framesPerSecond / samplerate;
+        }
+        return result;
     }
 
     bool LarmorSound::play(uint32_t startPosition)
@@ -421,7 +2117,8 @@ namespace Larmor {
             std::cout << "LarmorSound:: error: LarmorSound::initPlay has not been called, nothing to do!" << std::endl;
             return false;
         }
-        if (startPosition >= numSamples) {
+        // While loading a position after the ready samples waits for them
+        if (startPosition >= numSamples && loadComplete) {
             std::cout << "LarmorSound:: error startPosition: " << startPosition << " does not exist!" << std::endl;
             return false;
         }
@@ -433,10 +2130,14 @@ namespace Larmor {
         bool result = false;
         mutex.lock();
 
-        playPosition = startPosition;
-        playing = true;
-        SDL_PauseAudio(0);
-        result = true;
+        if (pushPlaybackCommand(PLAYBACK_COMMAND_PLAY, startPosition)) {
+            playPosition = startPosition;
+            playing = true;
+            if (!mixerVoice && !renderOutput) {
+                SDL_PauseAudio(0);
+            }
+            result = true;
+        }
 
         mutex.unlock();
         return result;
@@ -460,9 +2161,13 @@ namespace Larmor {
         mutex.lock();
 
         //playPosition = 0;
-        playing = true;
-        SDL_PauseAudio(0);
-        result = true;
+        if (pushPlaybackCommand(PLAYBACK_COMMAND_PLAY, PLAYBACK_POSITION_CURRENT)) {
+            playing = true;
+            if (!mixerVoice && !renderOutput) {
+                SDL_PauseAudio(0);
+            }
+            result = true;
+        }
 
         mutex.unlock();
         return result;
@@ -479,16 +2184,83 @@ namespace Larmor {
             return false;
         }
         if (!playing) {
+            // The callback stops the playback at the end of the track without pausing the device
+            mutex.lock();
+            if (!playing && !mixerVoice && !renderOutput) {
+                SDL_PauseAudio(1);
+            }
+            mutex.unlock();
             std::cout << "LarmorSound:: stream is already stopped!" << std::endl;
             return false;
         }
         bool result = false;
         mutex.lock();
 
-        SDL_PauseAudio(1);
-        playing = false;
-        result = true;
+        // The callback applies the stop when the device is resumed by the next play,
+        //  or at the next buffer of the mixer that keeps running for the other voices
+        if (pushPlaybackCommand(PLAYBACK_COMMAND_STOP, 0)) {
+            if (!mixerVoice && !renderOutput) {
+                SDL_PauseAudio(1);
+            }
+            playing = false;
+            result = true;
+        }
+
+        mutex.unlock();
+        return result;
+    }
+
+    uint32_t LarmorSound::getPlaybackClockPosition()
+    {
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return 0;
+        }
+
+        // Read a consistent snapshot of the last callback, without locking
+        uint32_t sequence = 0;
+        uint32_t position = 0;
+        uint32_t frames = 0;
+        int64_t timeNs = 0;
+        do
+        {
+            sequence = clockSequence.load(std::memory_order_acquire);
+            position = clockPosition.load(std::memory_order_relaxed);
+            frames = clockFrames.load(std::memory_order_relaxed);
+            timeNs = clockTimeNs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((sequence & 1) != 0 || sequence != clockSequence.load(std::memory_order_relaxed));
+
+        if (timeNs == 0) {
+            return playPosition; // no callback since initPlay
+        }
+
+        // The buffer written at timeNs starts to be heard after the device latency,
+        //  and the clock cannot go past the samples written so far
+        int64_t nowNs = renderOutput ? renderTimeNs.load() : std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        double heard = position + (nowNs - timeNs - playbackSpec.latencySeconds * 1e9) * 1e-9 * playbackSpec.freq;
+        heard = std::min(heard, (double)position + frames);
+        if (heard <= 0.0) {
+            return 0;
+        }
+        return std::min((uint32_t)heard, numSamples.load());
+    }
 
+    PlaybackSpec LarmorSound::getPlaybackSpec()
+    {
+        PlaybackSpec result;
+        memset(&result, 0, sizeof(result));
+        if (!initedCreation) {
+            std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
+            return result;
+        }
+        mutex.lock();
+        if (!initedPlay) {
+            std::cout << "LarmorSound:: error: LarmorSound::initPlay has not been called, nothing to do!" << std::endl;
+        } else {
+            result = playbackSpec;
+        }
         mutex.unlock();
         return result;
     }
@@ -518,13 +2290,7 @@ namespace Larmor {
             std::cout << "LarmorSound:: error: LarmorSound::initPlay has not been called, nothing to do!" << std::endl;
             return false;
         }
-        bool result = false;
-        mutex.lock();
-
-        result = playing;
-
-        mutex.unlock();
-        return result;
+        return playing;
     }
 
     uint32_t LarmorSound::getPlayPosition()
@@ -533,13 +2299,7 @@ namespace Larmor {
             std::cout << "LarmorSound:: error was in object creation, nothing to do!" << std::endl;
             return 0;
         }
-        uint32_t result = 0;
-        mutex.lock();
-
-        result = playPosition;
-
-        mutex.unlock();
-        return result;
+        return playPosition;
     }
 
     bool LarmorSound::closePlay()
@@ -553,9 +2313,25 @@ namespace Larmor {
             return false;
         }
         mutex.lock();
-        SDL_CloseAudio();
+        if (mixerVoice) {
+            {
+                std::lock_guard<std::mutex> lock(mixerMutex);
+                sharedMixer->removeVoice(this);
+            }
+            mixerVoice = false;
+            std::cout << "LarmorSound:: Close Audio: removed from the mixer" << std::endl;
+        } else if (renderOutput) {
+            renderOutput = false;
+        } else {
+            SDL_CloseAudio();
+            std::cout << "LarmorSound:: Close Audio: SDL_CloseAudio" << std::endl;
+        }
         initedPlay = false;
-        std::cout << "LarmorSound:: Close Audio: SDL_CloseAudio" << std::endl;
+        delete readahead;
+        readahead = NULL;
+        playbackInterleaved = NULL;
+        delete interleaved_samples;
+        interleaved_samples = NULL;
         mutex.unlock();
         return true;
     }
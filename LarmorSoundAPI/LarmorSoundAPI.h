@@ -30,7 +30,8 @@
 #define LARMORSOUNDAPI_H_
 
 #include <vector>
-#include <mutex> 
+#include <mutex>
+#include <atomic> 
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -44,7 +45,28 @@
 #include <SDL2/SDL.h>
 
 #define AUBIO_SAMPLE_BUFFER_SIZE 1024
+// Growth step of the sample buffers when the source duration is unknown
+#define SAMPLES_GROWTH_CHUNK (AUBIO_SAMPLE_BUFFER_SIZE * 256)
 #define HEARTBEAT_THRESHOLD_DEFAULT 500
+// Audio device buffer in sample frames: default, as the original playback, and minimum
+#define PLAYBACK_BUFFER_FRAMES_DEFAULT 4096
+#define PLAYBACK_BUFFER_FRAMES_MIN 64
+// Device buffers between the callback and the output used to estimate the latency:
+//  the one filled by the callback plays after the one the device is playing
+#define PLAYBACK_LATENCY_BUFFERS 2
+// Divisor of the callback time error applied to the playback clock, larger is smoother
+#define PLAYBACK_CLOCK_SMOOTHING 8
+// Pending play/stop/seek commands between the API threads and the audio callback
+#define PLAYBACK_COMMAND_QUEUE_SIZE 64
+// Position of a play command that continues from the current position
+#define PLAYBACK_POSITION_CURRENT UINT32_MAX
+// Voices of the software mixer playing at the same time
+#define MIXER_MAX_VOICES 256
+// Virtual time of the first buffer rendered by initRenderPlay, the playback clock
+//  takes a 0 time as no callback yet
+#define RENDER_CLOCK_START_NS 1000000000LL
+// Default memory budget of the asset cache, 1 GiB
+#define ASSET_CACHE_BUDGET_DEFAULT 1073741824ULL
 
 namespace Larmor {
 
@@ -52,55 +74,370 @@ namespace Larmor {
     typedef std::vector<smpl_t> vect_smpl;
     typedef std::vector<vect_smpl> vect_vect_smpl;
 
+    // Non owning view of contiguous samples, valid as long as the LarmorSound object
+    //  (the views got during an asynchronous loading only until LoadHandle::take)
+    class SmplView
+    {
+
+        private:
+
+            const smpl_t *ptr;
+            uint32_t length;
+
+        public:
+
+            SmplView() : ptr(NULL), length(0) {}
+
+            SmplView(const smpl_t *data, uint32_t size) : ptr(data), length(size) {}
+
+            const smpl_t *data() const { return ptr; }
+
+            uint32_t size() const { return length; }
+
+            bool empty() const { return length == 0; }
+
+            const smpl_t &operator[](uint32_t i) const { return ptr[i]; }
+
+            const smpl_t *begin() const { return ptr; }
+
+            const smpl_t *end() const { return ptr + length; }
+
+    };
+
+    template <typename T> class ChannelArena;
+    class AnalysisCache;
+    struct AnalysisCacheKey;
+    template <typename T> class SPSCQueue;
+    struct PlaybackCommand;
+    class AudioMixer;
+    class LoadHandle;
+    struct LoadState;
+    struct LoadProgress;
+    class LazyAnalysis;
+    class MappedReadahead;
+    struct SharedAsset;
+
+    // Window applied to the frames before the FFT
+    enum WindowType
+    {
+        WINDOW_RECTANGULAR = 0,  // no window, as the original non overlapping blocks
+        WINDOW_HANN = 1,
+        WINDOW_HAMMING = 2,
+        WINDOW_BLACKMAN = 3
+    };
+
+    // Value stored per spectrum bin, from the norm and the phase of the FFT
+    enum SpectrumMode
+    {
+        SPECTRUM_MAGNITUDE = 0,  // sqrt(norm^2 + phase^2), as the original spectrum
+        SPECTRUM_POWER = 1,      // norm^2 + phase^2
+        SPECTRUM_DB = 2          // 10 * log10(power), floored at -200 dB
+    };
+
+    // Storage of the spectrum values: 32 bit floats, or 16 / 8 bit codes of their level in dB
+    //  (about 1/2 and 1/4 of the float memory), see getChannelSpectrumCodes
+    enum SpectrumStorage
+    {
+        SPECTRUM_STORAGE_FLOAT = 0,
+        SPECTRUM_STORAGE_LOG16 = 1,
+        SPECTRUM_STORAGE_LOG8 = 2
+    };
+
+    // Storage of the track samples: 32 bit floats, or 16 bit integers (half the memory).
+    //  The int16 storage is exact for 16 bit sources, other sources are rounded to 16 bit;
+    //  the analysis and the playback use the stored samples
+    enum SampleStorage
+    {
+        SAMPLE_STORAGE_FLOAT = 0,
+        SAMPLE_STORAGE_INT16 = 1
+    };
+
+    // Range of the quantized codes: the same for all the frames, spectrumRangeDb below the
+    //  full scale of the FFT, or per frame, from its maximum down at most spectrumRangeDb
+    enum SpectrumScale
+    {
+        SPECTRUM_SCALE_GLOBAL = 0,
+        SPECTRUM_SCALE_BLOCK = 1
+    };
+
+    // Short time Fourier transform parameters and loading options:
+    //  the frame k is the FFT of the fftSize samples starting at k * hopSize
+    struct AnalysisOptions
+    {
+        uint32_t fftSize;       // samples per frame, a power of 2
+        uint32_t hopSize;       // samples between the start of two frames, 0 < hopSize <= fftSize
+        WindowType window;
+        SpectrumMode spectrumMode;
+        SpectrumStorage spectrumStorage;
+        SpectrumScale spectrumScale;
+        smpl_t spectrumRangeDb;  // dynamic range of the quantized spectrum, in dB
+        uint32_t numThreads;    // analysis threads, 0 means one per hardware core
+        bool lazySpectrum;      // only the samples are read at loading: the spectrum and the levels of a
+                                //  frame are computed on its first access, and in background from the
+                                //  play position. The analysis cache is read but not written
+        bool mappedStorage;     // out of core storage: the samples, spectra and levels are kept in temporary
+                                //  files mapped in memory (see setMappedStorageDirectory), so the kernel
+                                //  can page them out; the pages ahead of the play position are read in advance
+        SampleStorage sampleStorage;
+        double rangeStartSeconds;   // partial loading: only the samples of the file from rangeStartSeconds to
+        double rangeEndSeconds;     //  rangeEndSeconds (0 is the end of the file) are read, the position 0 of the
+                                    //  object is the sample at rangeStartSeconds (see getSourceOffset)
+        uint32_t channelMask;       // bit c loads the channel c of the file, 0 loads all of them; the loaded
+                                    //  channels are numbered from 0 in the order of the file
+
+        // Defaults: non overlapping unwindowed blocks of AUBIO_SAMPLE_BUFFER_SIZE samples
+        AnalysisOptions() : fftSize(AUBIO_SAMPLE_BUFFER_SIZE), hopSize(AUBIO_SAMPLE_BUFFER_SIZE), window(WINDOW_RECTANGULAR),
+            spectrumMode(SPECTRUM_MAGNITUDE), spectrumStorage(SPECTRUM_STORAGE_FLOAT),
+            spectrumScale(SPECTRUM_SCALE_GLOBAL), spectrumRangeDb(120.0f), numThreads(0),
+            lazySpectrum(false), mappedStorage(false),
+            sampleStorage(SAMPLE_STORAGE_FLOAT), rangeStartSeconds(0.0), rangeEndSeconds(0.0), channelMask(0) {}
+    };
+
+    // Raw codes of a quantized spectrum frame, one of codes8 and codes16 is set as the storage:
+    //  code 0 is silence, code c > 0 is the level floorDb + (c - 1) * stepDb in dB of the power
+    //  (magnitude = 10^(dB / 20), power = 10^(dB / 10)). With the global scale floorDb and stepDb
+    //  are the same for all the frames, so a code can index a color table directly
+    struct SpectrumCodes
+    {
+        const uint8_t *codes8;
+        const uint16_t *codes16;
+        uint32_t size;
+        smpl_t floorDb;
+        smpl_t stepDb;
+    };
+
+    // Time spent by the stages of the file loading, in seconds
+    struct LoadTimings
+    {
+        double decodeSeconds;       // reading and decoding the source
+        double analysisSeconds;     // FFT, summed over all the analysis threads
+        double storeSeconds;        // storing the spectra
+        double totalSeconds;        // wall clock time of the whole loading
+        uint32_t analysisThreads;
+    };
+
+    // Result of the loading of a LarmorSound object
+    enum LoadStatus
+    {
+        LOAD_PENDING = 0,           // asynchronous loading still running
+        LOAD_OK = 1,
+        LOAD_CANCELLED = 2,
+        LOAD_ERROR_DEPRECATED = 3,  // this beta version has expired
+        LOAD_ERROR_OPTIONS = 4,     // invalid AnalysisOptions
+        LOAD_ERROR_OPEN = 5,        // the file could not be opened
+        LOAD_ERROR_ANALYSIS = 6     // the analysis window or FFT could not be created
+    };
+
+    // Playback source of the audio callback
+    enum PlaybackMode
+    {
+        PLAYBACK_DIRECT = 0,        // interleaves the channel samples in the device buffer
+        PLAYBACK_INTERLEAVED = 1    // copies from an interleaved copy of the samples, built by initPlay
+    };
+
+    // Result of the last initMixerPlay of a LarmorSound object
+    enum MixerStatus
+    {
+        MIXER_OK = 0,
+        MIXER_ERROR_STATE = 1,      // object not created, or playback already initialized
+        MIXER_ERROR_DEVICE = 2,     // the audio device of the mixer could not be opened
+        MIXER_ERROR_FORMAT = 3,     // samplerate other than the mixer one, or channels neither its ones nor 1
+        MIXER_ERROR_FULL = 4        // the mixer already plays MIXER_MAX_VOICES voices
+    };
+
+    // Audio device opened by initPlay, as negotiated with SDL
+    struct PlaybackSpec
+    {
+        int freq;
+        uint16_t format;        // SDL_AudioFormat, always AUDIO_F32
+        uint8_t channels;
+        uint16_t samples;       // device buffer in sample frames, the callback granularity
+        uint32_t size;          // device buffer in bytes
+        double bufferSeconds;   // duration of the device buffer
+        double latencySeconds;  // estimated time from the callback to the output: the samples at
+                                //  getPlayPosition are heard about latencySeconds later
+    };
+
+    // Offline rendering since initRenderPlay: the frames rendered and the wall time spent
+    //  rendering them, so framesPerSecond is the throughput of the playback fill logic
+    struct RenderStats
+    {
+        uint64_t frames;
+        double renderSeconds;
+        double framesPerSecond;
+        double realtimeFactor;  // seconds of audio rendered per second of wall time
+    };
+
+    // Asset cache since the start of the process, see setAssetCacheActive
+    struct AssetCacheStats
+    {
+        uint32_t assets;        // analyses in the cache
+        uint32_t usedAssets;    // analyses used by at least one object, they are never evicted
+        uint64_t bytes;         // storage of the analyses in the cache
+        uint64_t budgetBytes;
+        uint64_t hits;          // objects created sharing a cached analysis
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
     class LarmorSound
     {
 
+        friend class AudioMixer;
+        friend class LoadHandle;
+
         private:
 
-            bool initedCreation;
+            std::atomic<bool> initedCreation;
+            LoadStatus loadStatus;
+            LoadProgress *loadProgress; // asynchronous loading only
+            std::atomic<bool> loadComplete;
             bool initedPlay;
-            bool playing;
-            uint32_t numSamples;
+            std::atomic<bool> playing;
+            std::atomic<uint32_t> numSamples; // watermark of the samples ready while loading
             uint32_t samplerate;
             uint8_t numChannels;
-            uint32_t playPosition;
-            vect_vect_smpl channels_samples;
-            std::vector<vect_vect_smpl> spectrum_samples;
+            std::atomic<uint32_t> playPosition;
+            ChannelArena<smpl_t> *channels_samples; // [channel][sample], float sample storage only
+            ChannelArena<int16_t> *channels_pcm; // [channel][sample], int16 sample storage only
+            ChannelArena<smpl_t> *spectrum_samples; // [channel][block][bin], float storage only
+            ChannelArena<uint8_t> *spectrum_codes; // [channel][block][floor, step, codes], quantized storage only
+            ChannelArena<smpl_t> *energy_samples; // [channel][block]
+            ChannelArena<smpl_t> *rms_samples; // [channel][block]
+            ChannelArena<smpl_t> *peak_samples; // [channel][block]
+            ChannelArena<double> *energy_prefix; // [channel][block + 1]
+            ChannelArena<double> *spectrum_prefix; // [channel][block + 1][bin], built on first use
+            std::once_flag spectrumPrefixOnce;
+            std::once_flag energyPrefixOnce;
+            LazyAnalysis *lazyAnalysis; // lazySpectrum only
+            AnalysisCache *analysisCache; // mapped cache file the arenas point into, if any
+            MappedReadahead *readahead; // mappedStorage only, while the playback is initialized
+            SharedAsset *sharedAsset; // asset cache entry the arenas are borrowed from, if any
+            // Serializes the API threads, never taken by the audio callback: the playback
+            //  state is atomic and play/stop/seek reach the callback through playbackCommands
             std::mutex mutex;
+            SPSCQueue<PlaybackCommand> *playbackCommands;
+            ChannelArena<smpl_t> *interleaved_samples; // [sample * numChannels + channel], PLAYBACK_INTERLEAVED only
+            const smpl_t *playbackInterleaved; // interleaved source of the callback, NULL with PLAYBACK_DIRECT
 
             // Heartbeat 
-            bool heartbeatActive;
-            uint64_t heartbeatThreshold;
-            uint64_t heartbeatLast;
+            std::atomic<bool> heartbeatActive;
+            std::atomic<uint64_t> heartbeatThreshold;
+            std::atomic<uint64_t> heartbeatLast;
+
+            LoadTimings loadTimings;
+            PlaybackSpec playbackSpec;
+
+            // Playback clock: the last buffer written by the callback, published with a seqlock
+            std::atomic<uint32_t> clockSequence;
+            std::atomic<uint32_t> clockPosition;    // first sample of the buffer
+            std::atomic<uint32_t> clockFrames;      // samples of the track in the buffer, 0 for silence
+            std::atomic<int64_t> clockTimeNs;       // steady_clock time of the callback
+            std::atomic<float> playbackGain;
+            bool mixerVoice; // played by the shared mixer instead of its own device
+            MixerStatus mixerStatus; // result of the last initMixerPlay
+            bool renderOutput; // rendered by the caller with render, without a device
+            std::atomic<int64_t> renderTimeNs; // virtual clock of the rendering
+            RenderStats renderStats;
+            AnalysisOptions analysisOptions;
 
         public:
 
             // Constructor
             //  Takes the file audio filename and read all the audio channels in memory and 
-            //  computes the FFT for all the tracks, populating the private class members
-            LarmorSound(const char *filename);
+            //  computes the FFT for all the tracks, populating the private class members.
+            //  The FFT of the blocks runs on numThreads threads, 0 means one per hardware core
+            LarmorSound(const char *filename, uint32_t numThreads = 0);
+
+            // Constructor
+            //  As above, with the STFT parameters of options: the spectrum, the levels and the
+            //  range queries of a position use the frame starting in the hop containing it
+            LarmorSound(const char *filename, const AnalysisOptions &options);
 
             // Destructor
             ~LarmorSound();
 
+            // Samples ready: while loading asynchronously the prefix whose frames are analyzed,
+            //  the getters of a position and the playback work on it
             uint32_t getNumSamples();
 
             uint32_t getSamplerate();
 
             uint8_t getNumChannels();
 
-            vect_smpl* getChannelSample(uint8_t numChannel);
+            // Sample of the file at the position 0, not 0 with AnalysisOptions::rangeStartSeconds
+            uint32_t getSourceOffset();
+
+            // Samples of the channel, empty view on error or with int16 sample storage
+            SmplView getChannelSample(uint8_t numChannel);
+
+            // count samples of the channel from position copied in samples, decoded with
+            //  int16 sample storage; less than count at the end of the samples ready
+            bool getChannelSamples(uint8_t numChannel, uint32_t position, uint32_t count, vect_smpl &samples);
+
+            // Spectrum of the frame at position, empty view on error or with quantized storage
+            SmplView getChannelSpectrum(uint8_t numChannel, uint32_t position);
 
-            vect_smpl* getChannelSpectrum(uint8_t numChannel, uint32_t position);
+            // Spectrum of the frame at position copied in spectrum, decoded with quantized storage
+            bool getChannelSpectrum(uint8_t numChannel, uint32_t position, vect_smpl &spectrum);
 
+            // Quantized codes of the frame at position, false with float storage
+            bool getChannelSpectrumCodes(uint8_t numChannel, uint32_t position, SpectrumCodes &codes);
+
+            // Levels of the frame at position, precomputed at loading:
+            //  energy is the sum of the spectrum magnitudes of the frame in every spectrum mode,
+            //  RMS and peak are computed on the frame samples
             smpl_t getChannelEnergy(uint8_t numChannel, uint32_t position);
 
+            smpl_t getChannelRMS(uint8_t numChannel, uint32_t position);
+
+            smpl_t getChannelPeak(uint8_t numChannel, uint32_t position);
+
+            // Range queries on the frames at the positions in [startPosition, endPosition),
+            //  answered in constant time (energy) or in the number of bins (spectrum) from prefix sums
+            smpl_t getChannelEnergyRange(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition);
+
+            smpl_t getChannelEnergyAverage(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition);
+
+            bool getChannelSpectrumAverage(uint8_t numChannel, uint32_t startPosition, uint32_t endPosition,
+                vect_smpl &spectrum);
+
+            AnalysisOptions getAnalysisOptions();
+
+            // Per stage timings of the constructor loading: decode, FFT analysis and store
+            LoadTimings getLoadTimings();
+
+            // Frames whose spectrum and levels are computed: all of them unless lazySpectrum
+            uint32_t getNumAnalyzedFrames();
+
+            // LOAD_OK when the object has been created, the cause of the error otherwise
+            LoadStatus getLoadStatus();
+
+            // False while an asynchronous loading is in progress: the range queries and
+            //  PLAYBACK_INTERLEAVED need the complete loading
+            bool isLoadComplete();
+
+            // Loads the file on a background thread and returns immediately: the handle reports
+            //  the progress, can cancel the loading and gives the object when it is complete.
+            //  Never NULL, the caller deletes the handle
+            static LoadHandle *loadAsync(const char *filename, const AnalysisOptions &options = AnalysisOptions());
+
+            // Loads the files on numThreads threads (0 means one per hardware core), the largest
+            //  first, each of them on one thread unless options.numThreads is set. Returns one
+            //  object per file in the same order, owned by the caller, with its getLoadStatus
+            static std::vector<LarmorSound *> loadBatch(const std::vector<std::string> &filenames,
+                const AnalysisOptions &options = AnalysisOptions(), uint32_t numThreads = 0);
+
             // It could take as parameter the pointer to a call back function:
             //    void (*userCallback)()
             //  and save userCallback in a member variable.
             //  In this case to call this funtion use:
             //    (*userCallback)();
-            bool initPlay();
+            //  PLAYBACK_INTERLEAVED makes the audio callback a single memcpy, for the memory of a
+            //  second copy of the samples (mono tracks are always played without copy)
+            //  bufferFrames is the device buffer, a power of 2: smaller buffers lower the latency and
+            //  update getPlayPosition more often, down to 64-256 frames on most devices
+            bool initPlay(PlaybackMode mode = PLAYBACK_DIRECT, uint16_t bufferFrames = PLAYBACK_BUFFER_FRAMES_DEFAULT);
 
             bool play(uint32_t startPosition);
 
@@ -108,14 +445,88 @@ namespace Larmor {
 
             bool stop();
 
+            // Negotiated device parameters and the estimated output latency, after initPlay
+            PlaybackSpec getPlaybackSpec();
+
             bool isInitedPlay();
 
             bool isPlaying();
 
             uint32_t getPlayPosition();
 
+            // Position of the sample heard now: extrapolated from the time of the last callback
+            //  with steady_clock and delayed by the estimated latency of PlaybackSpec, so it moves
+            //  sample by sample between the callbacks. It never takes a lock
+            uint32_t getPlaybackClockPosition();
+
             bool closePlay();
 
+            // Shared software mixer: one audio device for all the objects played with
+            //  initMixerPlay, mixed in the device callback with their playback gain.
+            //  closeMixer fails while some object is still a voice of the mixer
+            static bool openMixer(uint32_t samplerate, uint8_t channels,
+                uint16_t bufferFrames = PLAYBACK_BUFFER_FRAMES_DEFAULT);
+
+            static bool closeMixer();
+
+            // As initPlay, but plays as a voice of the shared mixer, opened with the samplerate
+            //  and channels of this object if not open: the samplerate must match the mixer,
+            //  the voices are not resampled, and the channels too or be one (played on all the
+            //  channels), else it fails with MIXER_ERROR_FORMAT. closePlay removes the voice
+            bool initMixerPlay(PlaybackMode mode = PLAYBACK_DIRECT);
+
+            // Why the last initMixerPlay failed, MIXER_OK if it succeeded or was never called
+            MixerStatus getMixerStatus();
+
+            // Linear gain of the playback, 1 by default, applied without locks by the callback
+            void setPlaybackGain(smpl_t gain);
+
+            smpl_t getPlaybackGain();
+
+            // As initPlay, but without audio device: the playback advances only when the caller
+            //  renders it, as fast as it can, with a virtual clock advanced by the duration of the
+            //  rendered frames and used by the heartbeat and getPlaybackClockPosition.
+            //  bufferFrames is the granularity of the rendering, as the device buffer
+            bool initRenderPlay(PlaybackMode mode = PLAYBACK_DIRECT, uint16_t bufferFrames = PLAYBACK_BUFFER_FRAMES_DEFAULT);
+
+            // Renders the next frames of the playback interleaved in out, as the audio callback does.
+            //  Returns the frames of the track written, the rest is silence
+            uint32_t render(float *out, uint32_t frames);
+
+            // Renders to a 32 bit float WAV file until the playback stops or is silent (heartbeat
+            //  missing), or maxFrames frames if not 0. Start the playback with play before.
+            //  False if the file can not be written or the rendering exceeds the 4 GiB of a WAV
+            //  file, which then keeps the frames that fit
+            bool renderToWav(const char *filename, uint32_t maxFrames = 0);
+
+            // Virtual time of the rendering in nanoseconds
+            int64_t getRenderTimeNs();
+
+            RenderStats getRenderStats();
+
+            // Analysis cache for all the objects created after the call: the first analysis
+            //  of a file is written to a cache file, keyed by path, size, mtime and analysis
+            //  parameters, and the next constructions of the same file map it with mmap.
+            //  The cache file is next to the media file, or in cacheDirectory if not NULL
+            static void setCacheActive(bool active, const char *cacheDirectory = NULL);
+
+            static bool isCacheActive();
+
+            // Directory of the temporary files of AnalysisOptions::mappedStorage, for the objects
+            //  created after the call. NULL or empty is TMPDIR, or /tmp. The files are deleted
+            //  at creation, so nothing is left after the object or the process ends
+            static void setMappedStorageDirectory(const char *directory);
+
+            // Shares the analyses between the objects created for the same file with the same
+            //  analysis options (the key of the analysis cache): the objects after the first
+            //  use its samples, spectra and levels without reading the file. The analyses no more
+            //  used are kept until the storage of all of them exceeds memoryBudgetBytes, then the
+            //  least recently used are released. The lazy objects use the shared analyses only.
+            //  Deactivating releases the analyses not in use
+            static void setAssetCacheActive(bool active, uint64_t memoryBudgetBytes = ASSET_CACHE_BUDGET_DEFAULT);
+
+            static AssetCacheStats getAssetCacheStats();
+
             void setHeartbeatActive(bool active, uint64_t heartbeatThresholdParam = 0);
 
             bool isHeartbeatActive();
@@ -124,10 +535,110 @@ namespace Larmor {
 
         private:
 
+            // Initializes the members, load reads the file: with progress the object is readable
+            //  while loading, the ready samples grow up to the end
+            LarmorSound(const AnalysisOptions &options, LoadProgress *progress);
+
+            void load(const char *filename);
+
+            // Body of the loadAsync thread
+            static void loadThread(LoadState *state);
+
             static void forwardSDLCallback(void *userdata, uint8_t *stream, int len);
 
             void memberSDLCallback(uint8_t *stream, int len);
 
+            // Audio thread: writes the next frames of the playback in out, interleaved, and returns
+            //  the frames of the track written, the rest is silence
+            uint32_t renderPlayback(float *out, uint32_t frames, int64_t callbackTimeNs);
+
+            // Interleaved copy, command queue and clock for a new playback
+            void preparePlayback(PlaybackMode mode);
+
+            // Time of the heartbeat in milliseconds: system clock, or virtual clock when rendering
+            uint64_t heartbeatNowMs();
+
+            bool pushPlaybackCommand(uint8_t type, uint32_t position);
+
+            void publishPlaybackClock(uint32_t position, uint32_t frames, int64_t callbackTimeNs);
+
+            void computeEnergyPrefix();
+
+            void computeSpectrumPrefix();
+
+            void readSpectrumRow(uint8_t numChannel, uint32_t block, smpl_t *values);
+
+            // Computes the block first with the lazy analysis
+            void ensureBlock(uint32_t block);
+
+            bool startLazyAnalysis(uint32_t totalRead, const vect_smpl &window);
+
+            void adviseReadahead(uint32_t firstSample, uint32_t samples);
+
+            void adoptAsset(SharedAsset *asset);
+
+            void shareAsset(const AnalysisCacheKey &cacheKey);
+
+            // Frees the arenas replaced while the asynchronous loading grew them
+            void releaseRetiredArenas();
+
+            bool loadAnalysisCache(const std::string &cachePath, const AnalysisCacheKey &cacheKey);
+
+    };
+
+    // Loading started by LarmorSound::loadAsync
+    class LoadHandle
+    {
+
+        friend class LarmorSound;
+
+        private:
+
+            LoadState *state;
+
+            LoadHandle(LoadState *loadState);
+
+        public:
+
+            // Cancels the loading if still running and waits for it, deletes the object if not taken
+            ~LoadHandle();
+
+            // LOAD_PENDING until the loading is complete, then the LarmorSound status
+            LoadStatus getStatus();
+
+            bool isDone();
+
+            // Waits the end of the loading for at most timeoutMs milliseconds, 0 waits until the end.
+            //  Returns isDone()
+            bool wait(uint32_t timeoutMs = 0);
+
+            // Asks the loading to stop: it ends with LOAD_CANCELLED at the next decoded block
+            void cancel();
+
+            // Analysis blocks stored so far, and the estimated total from the source duration
+            //  (0 when the duration is unknown)
+            uint32_t getBlocksDone();
+
+            uint32_t getBlocksTotal();
+
+            // Fraction of the blocks done, between 0 and 1
+            float getProgress();
+
+            // The object being loaded, owned by the handle: NULL until readable, then its getters
+            //  and play work on getNumSamples samples, growing until the loading is complete
+            LarmorSound *getSound();
+
+            // The loaded object, owned by the caller from now on: NULL unless LOAD_OK
+            //  or if already taken. The copies of the storage kept for the readers while it grew
+            //  are freed: the views got while loading become invalid, and no other thread may be
+            //  inside a call of the object got from getSound
+            LarmorSound *take();
+
+        private:
+
+            LoadHandle(const LoadHandle&);
+            LoadHandle& operator=(const LoadHandle&);
+
     };
 
 }
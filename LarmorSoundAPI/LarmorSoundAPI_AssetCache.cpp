@@ -0,0 +1,192 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API asset cache header
+#include "LarmorSoundAPI_AssetCache.h"
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+
+namespace Larmor {
+
+    // State of the asset cache, shared by all the LarmorSound objects
+    static std::mutex assetMutex;
+    static bool assetActive = false;
+    static uint64_t assetBudgetBytes = 0;
+    static std::map<std::string, SharedAsset *> assets;
+    static std::list<SharedAsset *> assetLru; // most recently used first
+    static uint64_t assetBytes = 0;
+    static uint64_t assetHits = 0;
+    static uint64_t assetMisses = 0;
+    static uint64_t assetEvictions = 0;
+
+    static std::string makeAssetKey(const AnalysisCacheKey &key)
+    {
+        std::stringstream assetKey;
+        assetKey << key.path << '\n' << key.sourceSize << ' ' << key.sourceMtime << ' ' << key.fftSize
+            << ' ' << key.hopSize << ' ' << key.windowType << ' ' << key.spectrumMode << ' ' << key.spectrumStorage
+            << ' ' << key.spectrumScale << ' ' << key.spectrumRangeDb << ' ' << key.sampleStorage
+            << ' ' << key.channelMask << ' ' << std::setprecision(17) << key.rangeStartSeconds
+            << ' ' << key.rangeEndSeconds;
+        return assetKey.str();
+    }
+
+    template <typename T>
+    static uint64_t arenaBytes(const ChannelArena<T> *arena)
+    {
+        return arena != NULL ? arena->getBytes() : 0;
+    }
+
+    static uint64_t assetArenaBytes(const SharedAsset *asset)
+    {
+        return arenaBytes(asset->samples) + arenaBytes(asset->pcm) + arenaBytes(asset->spectrum)
+            + arenaBytes(asset->codes) + arenaBytes(asset->energy) + arenaBytes(asset->rms)
+            + arenaBytes(asset->peak) + arenaBytes(asset->energyPrefix);
+    }
+
+    static void deleteAsset(SharedAsset *asset)
+    {
+        delete asset->samples;
+        delete asset->pcm;
+        delete asset->spectrum;
+        delete asset->codes;
+        delete asset->energy;
+        delete asset->rms;
+        delete asset->peak;
+        delete asset->energyPrefix;
+        delete asset->analysisCache; // after the arenas pointing into it
+        delete asset;
+    }
+
+    // Deletes the unused assets, least recently used first, until the cache fits the budget.
+    //  Called with assetMutex held
+    static void evictAssets()
+    {
+        std::list<SharedAsset *>::iterator it = assetLru.end();
+        while (it != assetLru.begin() && (!assetActive || assetBytes > assetBudgetBytes))
+        {
+            --it;
+            SharedAsset *asset = *it;
+            if (asset->references > 0) {
+                continue;
+            }
+            it = assetLru.erase(it);
+            assets.erase(asset->key);
+            assetBytes -= asset->bytes;
+            assetEvictions++;
+            deleteAsset(asset);
+        }
+    }
+
+    void AssetCache::configure(bool active, uint64_t budgetBytes)
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        assetActive = active;
+        assetBudgetBytes = budgetBytes;
+        evictAssets();
+    }
+
+    bool AssetCache::isActive()
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        return assetActive;
+    }
+
+    SharedAsset *AssetCache::acquire(const AnalysisCacheKey &key)
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        if (!assetActive) {
+            return NULL;
+        }
+        std::map<std::string, SharedAsset *>::iterator found = assets.find(makeAssetKey(key));
+        if (found == assets.end()) {
+            assetMisses++;
+            return NULL;
+        }
+        SharedAsset *asset = found->second;
+        asset->references++;
+        assetLru.splice(assetLru.begin(), assetLru, asset->lruPosition);
+        assetHits++;
+        return asset;
+    }
+
+    bool AssetCache::publish(const AnalysisCacheKey &key, SharedAsset *asset)
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        if (!assetActive) {
+            return false;
+        }
+        asset->key = makeAssetKey(key);
+        if (assets.find(asset->key) != assets.end()) {
+            return false;
+        }
+        asset->bytes = assetArenaBytes(asset);
+        asset->references = 1;
+        assetLru.push_front(asset);
+        asset->lruPosition = assetLru.begin();
+        assets[asset->key] = asset;
+        assetBytes += asset->bytes;
+        evictAssets();
+        return true;
+    }
+
+    void AssetCache::release(SharedAsset *asset)
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        asset->references--;
+        evictAssets();
+    }
+
+    void AssetCache::updateBytes(SharedAsset *asset)
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        uint64_t bytes = assetArenaBytes(asset);
+        assetBytes = assetBytes - asset->bytes + bytes;
+        asset->bytes = bytes;
+    }
+
+    AssetCacheStats AssetCache::getStats()
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        AssetCacheStats stats;
+        stats.assets = assets.size();
+        stats.usedAssets = 0;
+        for (std::list<SharedAsset *>::iterator it = assetLru.begin(); it != assetLru.end(); ++it) {
+            stats.usedAssets += (*it)->references > 0 ? 1 : 0;
+        }
+        stats.bytes = assetBytes;
+        stats.budgetBytes = assetBudgetBytes;
+        stats.hits = assetHits;
+        stats.misses = assetMisses;
+        stats.evictions = assetEvictions;
+        return stats;
+    }
+
+}
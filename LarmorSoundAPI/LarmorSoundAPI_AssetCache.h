@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_ASSETCACHE_H_
+#define LARMORSOUNDAPI_ASSETCACHE_H_
+
+#include <string>
+#include <list>
+#include <cstdint>
+
+#include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+#include "LarmorSoundAPI_Cache.h"
+
+namespace Larmor {
+
+    // Immutable analysis of a file shared by the LarmorSound objects created for it: the
+    //  objects borrow the arenas, the asset cache deletes them with the asset.
+    //  One of samples and pcm, and one of spectrum and codes, is NULL as in LarmorSound
+    struct SharedAsset
+    {
+        uint32_t numSamples;
+        uint32_t samplerate;
+        uint8_t numChannels;
+        AnalysisOptions options;
+        ChannelArena<smpl_t> *samples;
+        ChannelArena<int16_t> *pcm;
+        ChannelArena<smpl_t> *spectrum;
+        ChannelArena<uint8_t> *codes;
+        ChannelArena<smpl_t> *energy;
+        ChannelArena<smpl_t> *rms;
+        ChannelArena<smpl_t> *peak;
+        ChannelArena<double> *energyPrefix;
+        AnalysisCache *analysisCache; // mapped cache file the arenas point into, if any
+
+        // Set by the asset cache
+        std::string key;
+        uint64_t bytes;
+        uint32_t references;
+        std::list<SharedAsset *>::iterator lruPosition;
+    };
+
+    // Process wide cache of the shared assets, keyed by the analysis cache key (path, size,
+    //  mtime and the analysis options). The assets not used by any object are kept for the
+    //  next objects of the same file until the storage of all the assets exceeds the memory
+    //  budget, then they are deleted least recently used first. The used assets are never
+    //  deleted, so the budget can be exceeded while they are used
+    class AssetCache
+    {
+
+        public:
+
+            static void configure(bool active, uint64_t budgetBytes);
+
+            static bool isActive();
+
+            // Asset of key with one more reference, NULL if not cached or the cache is inactive
+            static SharedAsset *acquire(const AnalysisCacheKey &key);
+
+            // Adds the asset with one reference, the cache takes the ownership of its arenas.
+            //  False if the cache is inactive or an asset of key is already cached, the
+            //  caller keeps the ownership
+            static bool publish(const AnalysisCacheKey &key, SharedAsset *asset);
+
+            // Removes a reference, an unused asset can then be evicted
+            static void release(SharedAsset *asset);
+
+            // Counts again the storage of a used asset whose arenas released memory
+            static void updateBytes(SharedAsset *asset);
+
+            static AssetCacheStats getStats();
+
+        private:
+
+            AssetCache();
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_ASSETCACHE_H_ */
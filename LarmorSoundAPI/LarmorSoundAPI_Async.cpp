@@ -0,0 +1,209 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API asynchronous loading header
+#include "LarmorSoundAPI_Async.h"
+#include "LarmorSoundAPI_WorkerPool.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+namespace Larmor {
+
+    // Loading thread: the object exists before the loading, so the handle can give it
+    //  to the caller as soon as it is readable
+    void LarmorSound::loadThread(LoadState *state)
+    {
+        LarmorSound *sound = new LarmorSound(state->options, &state->progress);
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->sound = sound;
+        }
+        sound->load(state->filename.c_str());
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->status = sound->getLoadStatus();
+        }
+        state->loaded.notify_all();
+    }
+
+    LoadHandle *LarmorSound::loadAsync(const char *filename, const AnalysisOptions &options)
+    {
+        LoadState *state = new LoadState();
+        state->filename = filename;
+        state->options = options;
+        state->thread = std::thread(LarmorSound::loadThread, state);
+        return new LoadHandle(state);
+    }
+
+    // Bytes of a local file, 0 if it can not be opened (URLs, devices)
+    static uint64_t fileBytes(const std::string &filename)
+    {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (file == NULL) {
+            return 0;
+        }
+        uint64_t bytes = 0;
+        if (fseek(file, 0, SEEK_END) == 0) {
+            long end = ftell(file);
+            bytes = end > 0 ? end : 0;
+        }
+        fclose(file);
+        return bytes;
+    }
+
+    static bool largerFirst(const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b)
+    {
+        return a.first > b.first;
+    }
+
+    std::vector<LarmorSound *> LarmorSound::loadBatch(const std::vector<std::string> &filenames,
+        const AnalysisOptions &options, uint32_t numThreads)
+    {
+        std::vector<LarmorSound *> sounds(filenames.size(), (LarmorSound *)NULL);
+
+        // The longest loadings start first and the short ones fill the end of the batch
+        std::vector<std::pair<uint64_t, size_t> > order;
+        for (size_t i = 0; i < filenames.size(); i++)
+        {
+            order.push_back(std::make_pair(fileBytes(filenames[i]), i));
+        }
+        std::stable_sort(order.begin(), order.end(), largerFirst);
+
+        // The pool already uses the cores, so the files are analyzed on one thread each
+        AnalysisOptions fileOptions = options;
+        if (fileOptions.numThreads == 0) {
+            fileOptions.numThreads = 1;
+        }
+
+        WorkStealingPool pool(numThreads);
+        std::cout << "LarmorSound:: loading " << filenames.size() << " files on "
+            << pool.getNumThreads() << " threads..." << std::endl;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            size_t index = order[i].second;
+            pool.submit([&sounds, &filenames, &fileOptions, index](uint32_t) {
+                sounds[index] = new LarmorSound(filenames[index].c_str(), fileOptions);
+            });
+        }
+        pool.wait();
+        return sounds;
+    }
+
+    LoadHandle::LoadHandle(LoadState *loadState) : state(loadState)
+    {
+    }
+
+    LoadHandle::~LoadHandle()
+    {
+        cancel();
+        state->thread.join();
+        delete state->sound;
+        delete state;
+    }
+
+    LoadStatus LoadHandle::getStatus()
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->status;
+    }
+
+    bool LoadHandle::isDone()
+    {
+        return getStatus() != LOAD_PENDING;
+    }
+
+    bool LoadHandle::wait(uint32_t timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (timeoutMs == 0) {
+            while (state->status == LOAD_PENDING) {
+                state->loaded.wait(lock);
+            }
+            return true;
+        }
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(timeoutMs);
+        while (state->status == LOAD_PENDING) {
+            if (state->loaded.wait_until(lock, deadline) == std::cv_status::timeout) {
+                break;
+            }
+        }
+        return state->status != LOAD_PENDING;
+    }
+
+    void LoadHandle::cancel()
+    {
+        state->progress.cancelRequested = true;
+    }
+
+    uint32_t LoadHandle::getBlocksDone()
+    {
+        return state->progress.blocksDone;
+    }
+
+    uint32_t LoadHandle::getBlocksTotal()
+    {
+        return state->progress.blocksTotal;
+    }
+
+    float LoadHandle::getProgress()
+    {
+        if (getStatus() == LOAD_OK) {
+            return 1.0f;
+        }
+        uint32_t total = state->progress.blocksTotal;
+        if (total == 0) {
+            return 0.0f;
+        }
+        return std::min(1.0f, (float)state->progress.blocksDone / total);
+    }
+
+    LarmorSound *LoadHandle::getSound()
+    {
+        if (!state->progress.readable) {
+            return NULL;
+        }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->sound;
+    }
+
+    LarmorSound *LoadHandle::take()
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->status != LOAD_OK) {
+            return NULL;
+        }
+        LarmorSound *sound = state->sound;
+        state->sound = NULL;
+        sound->releaseRetiredArenas();
+        return sound;
+    }
+
+}
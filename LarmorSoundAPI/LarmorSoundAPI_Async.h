@@ -0,0 +1,70 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_ASYNC_H_
+#define LARMORSOUNDAPI_ASYNC_H_
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+
+#include "LarmorSoundAPI.h"
+
+namespace Larmor {
+
+    // Progress of a loading, written by the constructor and read by the LoadHandle
+    struct LoadProgress
+    {
+        std::atomic<uint32_t> blocksDone;
+        std::atomic<uint32_t> blocksTotal;  // estimated from the source duration, 0 if unknown
+        std::atomic<bool> cancelRequested;  // checked by the decode stage at every block
+        std::atomic<bool> readable;         // the getters work on the ready samples
+
+        LoadProgress() : blocksDone(0), blocksTotal(0), cancelRequested(false), readable(false) {}
+    };
+
+    // Shared by the LoadHandle and the loading thread
+    struct LoadState
+    {
+        std::string filename;
+        AnalysisOptions options;
+        LoadProgress progress;
+        std::mutex mutex;
+        std::condition_variable loaded;
+        LoadStatus status;      // under mutex
+        LarmorSound *sound;     // under mutex, owned by the handle until taken
+        std::thread thread;
+
+        LoadState() : status(LOAD_PENDING), sound(NULL) {}
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_ASYNC_H_ */
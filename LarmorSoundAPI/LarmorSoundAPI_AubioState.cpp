@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API aubio state header
+#include "LarmorSoundAPI_AubioState.h"
+
+namespace Larmor {
+
+    std::mutex AubioState::mutex;
+    uint32_t AubioState::liveObjects = 0;
+
+    void AubioState::releaseObject()
+    {
+        liveObjects--;
+        if (liveObjects == 0) {
+            aubio_cleanup();
+        }
+    }
+
+    aubio_fft_t *AubioState::newFFT(uint32_t fftSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        aubio_fft_t *fft = new_aubio_fft(fftSize);
+        if (fft != NULL) {
+            liveObjects++;
+        }
+        return fft;
+    }
+
+    void AubioState::deleteFFT(aubio_fft_t *fft)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        del_aubio_fft(fft);
+        releaseObject();
+    }
+
+    aubio_source_t *AubioState::newSource(const char *uri, uint32_t samplerate, uint32_t hopSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        aubio_source_t *source = new_aubio_source(uri, samplerate, hopSize);
+        if (source != NULL) {
+            liveObjects++;
+        }
+        return source;
+    }
+
+    void AubioState::deleteSource(aubio_source_t *source)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        del_aubio_source(source);
+        releaseObject();
+    }
+
+}
@@ -0,0 +1,70 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_AUBIOSTATE_H_
+#define LARMORSOUNDAPI_AUBIOSTATE_H_
+
+#include <mutex>
+#include <cstdint>
+
+#include "LarmorSoundAPI.h"
+
+namespace Larmor {
+
+    // Creation and deletion of the aubio objects backed by process wide state: the FFT plans
+    //  (FFTW keeps a global planner) and the sources (the codec libraries register globally).
+    //  Each call runs under one mutex, so objects can be loaded on many threads at once, and
+    //  aubio_cleanup, which frees that state, runs only when the last such object is deleted
+    //  instead of at the end of every loading
+    class AubioState
+    {
+
+        private:
+
+            static std::mutex mutex;
+            static uint32_t liveObjects;
+
+            // Under mutex: one object less, cleanup when none is left
+            static void releaseObject();
+
+        public:
+
+            // NULL as the aubio functions on error
+            static aubio_fft_t *newFFT(uint32_t fftSize);
+
+            static void deleteFFT(aubio_fft_t *fft);
+
+            static aubio_source_t *newSource(const char *uri, uint32_t samplerate, uint32_t hopSize);
+
+            static void deleteSource(aubio_source_t *source);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_AUBIOSTATE_H_ */
@@ -0,0 +1,171 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API block ring header
+#include "LarmorSoundAPI_BlockRing.h"
+#include "LarmorSoundAPI_Quantizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Larmor {
+
+    // Analyzes one channel of a decoded frame: the RMS and the peak of the read samples,
+    //  then the spectrum of the windowed frame and its energy (the sum of the spectrum),
+    //  quantized if quantizer is not NULL.
+    //  The result only depends on the frame samples, not on the thread that computes it
+    void analyzeBlockChannel(aubio_fft_t *fft, cvec_t *fftgrain, const vect_smpl &window,
+        spectrum_kernel kernel, const SpectrumQuantizer *quantizer, AnalysisBlock *block, uint8_t channel)
+    {
+        // fmat_get_channel makes the fvec point to the matrix row, nothing is copied
+        fvec_t in;
+        fmat_get_channel(block->samples, channel, &in);
+
+        double squares = 0.0;
+        smpl_t peak = 0.0;
+        for (uint32_t i = 0; i < block->read; i++)
+        {
+            squares += in.data[i] * in.data[i];
+            peak = std::max(peak, (smpl_t)fabs(in.data[i]));
+        }
+        block->rms[channel] = block->read > 0 ? sqrt(squares / block->read) : 0.0;
+        block->peak[channel] = peak;
+
+        // Apply the window, none for the rectangular one
+        for (uint32_t i = 0; i < window.size(); i++)
+        {
+            in.data[i] *= window[i];
+        }
+
+        // Clean previous values
+        cvec_zeros(fftgrain);
+
+        // Compute FFT
+        aubio_fft_do(fft, &in, fftgrain);
+
+        // Store FFT sample, the kernel writes the whole row. The energy is the sum of the
+        //  magnitudes in every spectrum mode: they are written in the row first, then replaced
+        //  by the values of the mode
+        smpl_t *spectrum_values = block->spectra->row(channel, 0);
+        spectrum_kernel magnitude = getSpectrumKernels().magnitude;
+        magnitude(fftgrain->norm, fftgrain->phas, spectrum_values, fftgrain->length);
+        smpl_t energy = 0.0;
+        for (uint32_t j = 0; j < fftgrain->length; j++)
+        {
+            energy += spectrum_values[j];
+        }
+        block->energy[channel] = energy;
+        if (kernel != magnitude) {
+            kernel(fftgrain->norm, fftgrain->phas, spectrum_values, fftgrain->length);
+        }
+
+        if (quantizer != NULL) {
+            quantizer->quantize(spectrum_values, fftgrain->length, block->codes->row(channel, 0));
+        }
+    }
+
+    void readStoredSamples(const ChannelArena<smpl_t> *samples, const ChannelArena<int16_t> *pcm,
+        uint8_t channel, uint32_t start, uint32_t length, smpl_t *out)
+    {
+        if (pcm != NULL) {
+            getPcmKernels().decode(pcm->row(channel, start), out, length);
+        } else {
+            const smpl_t *stored = samples->row(channel, start);
+            std::copy(stored, stored + length, out);
+        }
+    }
+
+    BlockQueue::BlockQueue() : closed(false)
+    {
+    }
+
+    void BlockQueue::push(AnalysisBlock *block)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.push_back(block);
+        }
+        blockAvailable.notify_one();
+    }
+
+    AnalysisBlock *BlockQueue::pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!closed && blocks.empty()) {
+            blockAvailable.wait(lock);
+        }
+        if (blocks.empty()) {
+            return NULL; // closed
+        }
+        AnalysisBlock *block = blocks.front();
+        blocks.pop_front();
+        return block;
+    }
+
+    void BlockQueue::close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        blockAvailable.notify_all();
+    }
+
+    BlockRing::BlockRing(uint32_t numBlocks, uint32_t numChannels, uint32_t blockSize, uint32_t numBins,
+        uint32_t codeRowBytes) : blocks(numBlocks)
+    {
+        for (uint32_t i = 0; i < numBlocks; i++)
+        {
+            blocks[i].samples = new_fmat(numChannels, blockSize);
+            blocks[i].index = 0;
+            blocks[i].read = 0;
+            blocks[i].spectra = new ChannelArena<smpl_t>(numChannels, numBins);
+            blocks[i].spectra->resize(1);
+            blocks[i].codes = NULL;
+            if (codeRowBytes > 0) {
+                blocks[i].codes = new ChannelArena<uint8_t>(numChannels, codeRowBytes);
+                blocks[i].codes->resize(1);
+            }
+            blocks[i].energy.resize(numChannels);
+            blocks[i].rms.resize(numChannels);
+            blocks[i].peak.resize(numChannels);
+            freeBlocks.push(&blocks[i]);
+        }
+    }
+
+    BlockRing::~BlockRing()
+    {
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            del_fmat(blocks[i].samples);
+            delete blocks[i].spectra;
+            delete blocks[i].codes;
+        }
+    }
+
+}
@@ -0,0 +1,121 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_BLOCKRING_H_
+#define LARMORSOUNDAPI_BLOCKRING_H_
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+#include "LarmorSoundAPI_SIMD.h"
+
+namespace Larmor {
+
+    // Block of decoded samples travelling through the loading pipeline
+    struct AnalysisBlock
+    {
+        fmat_t *samples;         // one row of blockSize samples per channel
+        uint32_t index;          // position of the block in the track
+        uint32_t read;           // valid samples in the block
+        ChannelArena<smpl_t> *spectra; // aligned spectrum row per channel, filled by the analysis stage
+        ChannelArena<uint8_t> *codes;  // quantized spectrum row per channel, NULL with float storage
+        vect_smpl energy;        // spectrum energy per channel, filled by the analysis stage
+        vect_smpl rms;           // samples RMS per channel, filled by the analysis stage
+        vect_smpl peak;          // samples absolute peak per channel, filled by the analysis stage
+    };
+
+    class SpectrumQuantizer;
+
+    // Fills the levels and the spectrum of one channel of a decoded block
+    void analyzeBlockChannel(aubio_fft_t *fft, cvec_t *fftgrain, const vect_smpl &window,
+        spectrum_kernel kernel, const SpectrumQuantizer *quantizer, AnalysisBlock *block, uint8_t channel);
+
+    // Copies length stored samples of a channel from start in out: samples is the float
+    //  sample storage, pcm the int16 one, decoded (the other is NULL)
+    void readStoredSamples(const ChannelArena<smpl_t> *samples, const ChannelArena<int16_t> *pcm,
+        uint8_t channel, uint32_t start, uint32_t length, smpl_t *out);
+
+    // Blocking FIFO of blocks: pop returns NULL once the queue is closed and empty
+    class BlockQueue
+    {
+
+        private:
+
+            std::deque<AnalysisBlock *> blocks;
+            std::mutex mutex;
+            std::condition_variable blockAvailable;
+            bool closed;
+
+        public:
+
+            BlockQueue();
+
+            void push(AnalysisBlock *block);
+
+            AnalysisBlock *pop();
+
+            void close();
+
+    };
+
+    // Fixed ring of blocks shared by the decode, analysis and store stages.
+    //  A block goes free -> decoded -> analyzed -> free, so no more than numBlocks
+    //  blocks are in flight and the decoder cannot run ahead of the analysis
+    class BlockRing
+    {
+
+        private:
+
+            std::vector<AnalysisBlock> blocks;
+
+        public:
+
+            BlockQueue freeBlocks;
+            BlockQueue decodedBlocks;
+            BlockQueue analyzedBlocks;
+
+            // codeRowBytes is the size of a quantized spectrum row, 0 with float storage
+            BlockRing(uint32_t numBlocks, uint32_t numChannels, uint32_t blockSize, uint32_t numBins,
+                uint32_t codeRowBytes);
+
+            ~BlockRing();
+
+        private:
+
+            BlockRing(const BlockRing&);
+            BlockRing& operator=(const BlockRing&);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_BLOCKRING_H_ */
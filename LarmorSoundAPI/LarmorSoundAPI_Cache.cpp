@@ -0,0 +1,335 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API analysis cache header
+#include "LarmorSoundAPI_Cache.h"
+#include "LarmorSoundAPI_Quantizer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+
+#if !defined(PLATFORM_WINDOWS)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <limits.h>
+    #include <stdlib.h>
+#endif
+
+namespace Larmor {
+
+    static const char ANALYSIS_CACHE_MAGIC[8] = { 'L', 'S', 'A', 'C', 'A', 'C', 'H', 'E' };
+
+    // Suffix of the temporary files, so the threads saving the same cache do not share one
+    static std::atomic<uint32_t> tmpSequence(0);
+
+    static uint64_t alignOffset(uint64_t offset)
+    {
+        return (offset + CHANNEL_ARENA_ALIGNMENT - 1) / CHANNEL_ARENA_ALIGNMENT * CHANNEL_ARENA_ALIGNMENT;
+    }
+
+    // Bytes of one channel of a section of rows of rowSize elements, padded so the next
+    //  channel starts aligned
+    template <typename T>
+    static uint64_t channelBytes(uint32_t rows, uint32_t rowSize)
+    {
+        return alignOffset((uint64_t)rows * ChannelArena<T>::rowStrideFor(rowSize) * sizeof(T));
+    }
+
+    template <typename T>
+    static uint64_t channelBytes(uint32_t rows, const ChannelArena<T> &arena)
+    {
+        return alignOffset((uint64_t)rows * arena.getRowStride() * sizeof(T));
+    }
+
+    // Sets the section offsets and the file size from the counts and the storage of the header:
+    //  save writes this layout and load accepts only files that match it
+    static void computeLayout(AnalysisCacheHeader &header)
+    {
+        uint64_t samplesBytes = header.sampleStorage == SAMPLE_STORAGE_INT16
+            ? channelBytes<int16_t>(header.numSamples, 1) : channelBytes<smpl_t>(header.numSamples, 1);
+        uint64_t spectrumBytes;
+        if (header.spectrumStorage != SPECTRUM_STORAGE_FLOAT) {
+            AnalysisOptions options;
+            options.fftSize = header.fftSize;
+            options.spectrumMode = (SpectrumMode)header.spectrumMode;
+            options.spectrumStorage = (SpectrumStorage)header.spectrumStorage;
+            options.spectrumScale = (SpectrumScale)header.spectrumScale;
+            options.spectrumRangeDb = header.spectrumRangeDb;
+            spectrumBytes = channelBytes<uint8_t>(header.numBlocks,
+                SpectrumQuantizer(options).getRowBytes(header.numBins));
+        } else {
+            spectrumBytes = channelBytes<smpl_t>(header.numBlocks, header.numBins);
+        }
+        uint64_t blockBytes = channelBytes<smpl_t>(header.numBlocks, 1);
+        uint64_t numChannels = header.numChannels;
+        header.samplesOffset = alignOffset(sizeof(header) + header.pathLength);
+        header.spectrumOffset = header.samplesOffset + numChannels * samplesBytes;
+        header.energyOffset = header.spectrumOffset + numChannels * spectrumBytes;
+        header.rmsOffset = header.energyOffset + numChannels * blockBytes;
+        header.peakOffset = header.rmsOffset + numChannels * blockBytes;
+        header.fileSize = header.peakOffset + numChannels * blockBytes;
+    }
+
+    // True if the offsets and the file size stored in the header are the ones of its counts
+    static bool layoutMatches(const AnalysisCacheHeader &header)
+    {
+        if (header.numChannels == 0 || header.numBins != header.fftSize / 2 + 1) {
+            return false;
+        }
+        AnalysisCacheHeader expected = header;
+        computeLayout(expected);
+        return expected.samplesOffset == header.samplesOffset
+            && expected.spectrumOffset == header.spectrumOffset
+            && expected.energyOffset == header.energyOffset
+            && expected.rmsOffset == header.rmsOffset
+            && expected.peakOffset == header.peakOffset
+            && expected.fileSize == header.fileSize;
+    }
+
+    template <typename T>
+    static bool writeSection(FILE *file, ChannelArena<T> &arena, uint32_t rows)
+    {
+        uint64_t bytes = (uint64_t)rows * arena.getRowStride() * sizeof(T);
+        std::vector<uint8_t> padding(channelBytes(rows, arena) - bytes, 0);
+        for (uint8_t channel = 0; channel < arena.getNumChannels(); channel++)
+        {
+            if (bytes > 0 && fwrite(arena.row(channel, 0), 1, bytes, file) != bytes) {
+                return false;
+            }
+            if (!padding.empty() && fwrite(&padding[0], 1, padding.size(), file) != padding.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AnalysisCache::AnalysisCache() : mapping(NULL), mappingSize(0), header(NULL)
+    {
+    }
+
+    AnalysisCache::~AnalysisCache()
+    {
+#if !defined(PLATFORM_WINDOWS)
+        if (mapping != NULL) {
+            munmap(mapping, mappingSize);
+        }
+#endif
+    }
+
+    AnalysisCache *AnalysisCache::load(const std::string &cachePath, const AnalysisCacheKey &key)
+    {
+#if defined(PLATFORM_WINDOWS)
+        return NULL;
+#else
+        int fd = open(cachePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return NULL;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AnalysisCacheHeader)) {
+            close(fd);
+            return NULL;
+        }
+        void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the file referenced
+        if (mapping == MAP_FAILED) {
+            return NULL;
+        }
+
+        const AnalysisCacheHeader *header = static_cast<const AnalysisCacheHeader *>(mapping);
+        const char *path = static_cast<const char *>(mapping) + sizeof(AnalysisCacheHeader);
+        bool valid = memcmp(header->magic, ANALYSIS_CACHE_MAGIC, sizeof(ANALYSIS_CACHE_MAGIC)) == 0
+            && header->version == ANALYSIS_CACHE_VERSION
+            && header->smplSize == sizeof(smpl_t)
+            && header->fileSize == (uint64_t)st.st_size
+            && header->sourceSize == key.sourceSize
+            && header->sourceMtime == key.sourceMtime
+            && header->fftSize == key.fftSize
+            && header->hopSize == key.hopSize
+            && header->windowType == key.windowType
+            && header->spectrumMode == key.spectrumMode
+            && header->spectrumStorage == key.spectrumStorage
+            && header->spectrumScale == key.spectrumScale
+            && header->spectrumRangeDb == key.spectrumRangeDb
+            && header->sampleStorage == key.sampleStorage
+            && header->channelMask == key.channelMask
+            && header->rangeStartSeconds == key.rangeStartSeconds
+            && header->rangeEndSeconds == key.rangeEndSeconds
+            && header->pathLength == key.path.size()
+            && layoutMatches(*header)
+            && key.path.compare(0, std::string::npos, path, header->pathLength) == 0;
+        if (!valid) {
+            munmap(mapping, st.st_size);
+            return NULL;
+        }
+
+        AnalysisCache *cache = new AnalysisCache();
+        cache->mapping = mapping;
+        cache->mappingSize = st.st_size;
+        cache->header = header;
+        return cache;
+#endif
+    }
+
+    bool AnalysisCache::save(const std::string &cachePath, const AnalysisCacheKey &key, uint32_t samplerate,
+        uint32_t numSamples, ChannelArena<smpl_t> *samples, ChannelArena<int16_t> *pcm,
+        ChannelArena<smpl_t> *spectrum, ChannelArena<uint8_t> *spectrumCodes, ChannelArena<smpl_t> &energy, ChannelArena<smpl_t> &rms,
+        ChannelArena<smpl_t> &peak)
+    {
+#if defined(PLATFORM_WINDOWS)
+        return false;
+#else
+        uint32_t numBlocks = energy.getNumRows();
+        uint8_t numChannels = energy.getNumChannels();
+
+        AnalysisCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ANALYSIS_CACHE_MAGIC, sizeof(ANALYSIS_CACHE_MAGIC));
+        header.version = ANALYSIS_CACHE_VERSION;
+        header.smplSize = sizeof(smpl_t);
+        header.sourceSize = key.sourceSize;
+        header.sourceMtime = key.sourceMtime;
+        header.fftSize = key.fftSize;
+        header.hopSize = key.hopSize;
+        header.windowType = key.windowType;
+        header.spectrumMode = key.spectrumMode;
+        header.spectrumStorage = key.spectrumStorage;
+        header.spectrumScale = key.spectrumScale;
+        header.spectrumRangeDb = key.spectrumRangeDb;
+        header.sampleStorage = key.sampleStorage;
+        header.channelMask = key.channelMask;
+        header.rangeStartSeconds = key.rangeStartSeconds;
+        header.rangeEndSeconds = key.rangeEndSeconds;
+        header.samplerate = samplerate;
+        header.numSamples = numSamples;
+        header.numBlocks = numBlocks;
+        header.numBins = key.fftSize / 2 + 1;
+        header.numChannels = numChannels;
+        header.pathLength = key.path.size();
+        computeLayout(header);
+
+        std::stringstream tmpPath;
+        tmpPath << cachePath << ".tmp" << getpid() << "." << tmpSequence++;
+        FILE *file = fopen(tmpPath.str().c_str(), "wb");
+        if (file == NULL) {
+            return false;
+        }
+        std::vector<uint8_t> padding(header.samplesOffset - sizeof(header) - header.pathLength, 0);
+        bool written = fwrite(&header, 1, sizeof(header), file) == sizeof(header)
+            && fwrite(key.path.data(), 1, key.path.size(), file) == key.path.size()
+            && (padding.empty() || fwrite(&padding[0], 1, padding.size(), file) == padding.size())
+            && (samples != NULL ? writeSection(file, *samples, numSamples) : writeSection(file, *pcm, numSamples))
+            && (spectrum != NULL ? writeSection(file, *spectrum, numBlocks)
+                : writeSection(file, *spectrumCodes, numBlocks))
+            && writeSection(file, energy, numBlocks)
+            && writeSection(file, rms, numBlocks)
+            && writeSection(file, peak, numBlocks);
+        written = (fclose(file) == 0) && written;
+        if (!written || rename(tmpPath.str().c_str(), cachePath.c_str()) != 0) {
+            remove(tmpPath.str().c_str());
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    bool AnalysisCache::makeKey(const char *filename, const AnalysisOptions &options, AnalysisCacheKey &key)
+    {
+#if defined(PLATFORM_WINDOWS)
+        return false;
+#else
+        struct stat st;
+        if (stat(filename, &st) != 0) {
+            return false;
+        }
+        char resolved[PATH_MAX];
+        key.path = realpath(filename, resolved) != NULL ? resolved : filename;
+        key.sourceSize = st.st_size;
+        key.sourceMtime = st.st_mtime;
+        key.fftSize = options.fftSize;
+        key.hopSize = options.hopSize;
+        key.windowType = options.window;
+        key.spectrumMode = options.spectrumMode;
+        key.spectrumStorage = options.spectrumStorage;
+        key.spectrumScale = options.spectrumScale;
+        key.spectrumRangeDb = options.spectrumRangeDb;
+        key.sampleStorage = options.sampleStorage;
+        key.channelMask = options.channelMask;
+        key.rangeStartSeconds = options.rangeStartSeconds;
+        key.rangeEndSeconds = options.rangeEndSeconds;
+        return true;
+#endif
+    }
+
+    std::string AnalysisCache::makePath(const AnalysisCacheKey &key, const std::string &cacheDirectory)
+    {
+        if (cacheDirectory.empty()) {
+            return key.path + ANALYSIS_CACHE_EXTENSION;
+        }
+        // FNV-1a hash of the path
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < key.path.size(); i++)
+        {
+            hash ^= (uint8_t)key.path[i];
+            hash *= 1099511628211ULL;
+        }
+        std::stringstream path;
+        path << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash
+            << ANALYSIS_CACHE_EXTENSION;
+        return path.str();
+    }
+
+    const AnalysisCacheHeader &AnalysisCache::getHeader()
+    {
+        return *header;
+    }
+
+    template <typename T>
+    void AnalysisCache::attach(uint64_t sectionOffset, uint32_t rows, ChannelArena<T> &arena)
+    {
+        uint8_t *section = static_cast<uint8_t *>(mapping) + sectionOffset;
+        uint64_t bytes = channelBytes(rows, arena);
+        std::vector<T *> channels(arena.getNumChannels());
+        for (uint8_t channel = 0; channel < arena.getNumChannels(); channel++)
+        {
+            channels[channel] = reinterpret_cast<T *>(section + channel * bytes);
+        }
+        arena.attach(channels, rows);
+    }
+
+    template void AnalysisCache::attach<smpl_t>(uint64_t, uint32_t, ChannelArena<smpl_t> &);
+    template void AnalysisCache::attach<uint8_t>(uint64_t, uint32_t, ChannelArena<uint8_t> &);
+    template void AnalysisCache::attach<int16_t>(uint64_t, uint32_t, ChannelArena<int16_t> &);
+
+}
@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_CACHE_H_
+#define LARMORSOUNDAPI_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+
+// Version of the analysis cache file format, increase it when the layout changes
+#define ANALYSIS_CACHE_VERSION 7
+#define ANALYSIS_CACHE_EXTENSION ".lsacache"
+
+namespace Larmor {
+
+    // Identifies the analysis of a media file: a cache file is valid only if all fields match
+    struct AnalysisCacheKey
+    {
+        std::string path;
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        uint32_t fftSize;
+        uint32_t hopSize;
+        uint32_t windowType;
+        uint32_t spectrumMode;
+        uint32_t spectrumStorage;
+        uint32_t spectrumScale;
+        float spectrumRangeDb;
+        uint32_t sampleStorage;
+        uint32_t channelMask;
+        double rangeStartSeconds;
+        double rangeEndSeconds;
+    };
+
+    // Header at the beginning of a cache file, followed by the source path.
+    //  The data sections start at CHANNEL_ARENA_ALIGNMENT offsets and each channel of a
+    //  section has the layout of a ChannelArena, so the arenas point into the mapped file
+    struct AnalysisCacheHeader
+    {
+        char magic[8];
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        uint64_t samplesOffset;
+        uint64_t spectrumOffset;
+        uint64_t energyOffset;
+        uint64_t rmsOffset;
+        uint64_t peakOffset;
+        uint64_t fileSize;
+        uint32_t version;
+        uint32_t smplSize;
+        uint32_t fftSize;
+        uint32_t hopSize;
+        uint32_t windowType;
+        uint32_t spectrumMode;
+        uint32_t samplerate;
+        uint32_t numSamples;
+        uint32_t numBlocks;
+        uint32_t numBins;
+        uint32_t numChannels;
+        uint32_t pathLength;
+        uint32_t spectrumStorage;
+        uint32_t spectrumScale;
+        float spectrumRangeDb;
+        uint32_t sampleStorage;
+        uint32_t channelMask;
+        double rangeStartSeconds;
+        double rangeEndSeconds;
+    };
+
+    // Analysis read from a cache file through mmap: the pages are shared with the
+    //  OS page cache, so reopening a file in other processes does not copy it again
+    class AnalysisCache
+    {
+
+        private:
+
+            void *mapping;
+            size_t mappingSize;
+            const AnalysisCacheHeader *header;
+
+            AnalysisCache();
+
+        public:
+
+            ~AnalysisCache();
+
+            // Maps the cache file, NULL if it does not exist or does not match the key
+            static AnalysisCache *load(const std::string &cachePath, const AnalysisCacheKey &key);
+
+            // Writes the analysis in a temporary file renamed to cachePath when complete,
+            //  so concurrent readers never see a partial cache file. The spectrum section is
+            //  spectrum with float storage, spectrumCodes with quantized storage, the samples section
+            //  is samples with float sample storage, pcm with int16 one (the other is NULL)
+            static bool save(const std::string &cachePath, const AnalysisCacheKey &key, uint32_t samplerate,
+                uint32_t numSamples, ChannelArena<smpl_t> *samples, ChannelArena<int16_t> *pcm,
+                ChannelArena<smpl_t> *spectrum,
+                ChannelArena<uint8_t> *spectrumCodes, ChannelArena<smpl_t> &energy, ChannelArena<smpl_t> &rms,
+                ChannelArena<smpl_t> &peak);
+
+            // Fills key with the stat of filename, false if the file can not be stat
+            static bool makeKey(const char *filename, const AnalysisOptions &options, AnalysisCacheKey &key);
+
+            // Sidecar file next to the media file if cacheDirectory is empty,
+            //  otherwise a file in cacheDirectory named from the hash of the path
+            static std::string makePath(const AnalysisCacheKey &key, const std::string &cacheDirectory);
+
+            const AnalysisCacheHeader &getHeader();
+
+            // Points the arena channels to a section of the mapped file
+            template <typename T>
+            void attach(uint64_t sectionOffset, uint32_t rows, ChannelArena<T> &arena);
+
+        private:
+
+            AnalysisCache(const AnalysisCache&);
+            AnalysisCache& operator=(const AnalysisCache&);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_CACHE_H_ */
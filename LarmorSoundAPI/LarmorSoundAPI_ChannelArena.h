@@ -0,0 +1,337 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_CHANNELARENA_H_
+#define LARMORSOUNDAPI_CHANNELARENA_H_
+
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#include "LarmorSoundAPI_MappedFile.h"
+
+#if defined(PLATFORM_WINDOWS)
+    #include <malloc.h>
+#endif
+
+// Alignment in bytes of the arenas and of their rows, enough for AVX loads
+#define CHANNEL_ARENA_ALIGNMENT 64
+
+namespace Larmor {
+
+    // NULL when the memory can not be allocated
+    inline void *alignedTryAlloc(size_t size)
+    {
+#if defined(PLATFORM_WINDOWS)
+        void *ptr = _aligned_malloc(size, CHANNEL_ARENA_ALIGNMENT);
+#else
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, CHANNEL_ARENA_ALIGNMENT, size) != 0) {
+            ptr = NULL;
+        }
+#endif
+        return ptr;
+    }
+
+    inline void *alignedAlloc(size_t size)
+    {
+        void *ptr = alignedTryAlloc(size);
+        if (ptr == NULL) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    inline void alignedFree(void *ptr)
+    {
+#if defined(PLATFORM_WINDOWS)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    // Contiguous storage of rows of rowSize elements, one aligned arena per channel:
+    //  the element i of the row r of a channel is at channels[channel][r * rowStride + i].
+    //  When rowSize > 1 the rows are padded with zeros to CHANNEL_ARENA_ALIGNMENT bytes,
+    //  so every row starts aligned.
+    //  The channels can also point to external memory (i.e. a memory mapped file), which
+    //  is never freed by the arena and is copied in owned memory if the arena grows.
+    //  The channel pointers are atomic: with retainOnGrow the replaced arenas are kept until
+    //  releaseRetired or the destruction, so the rows published to other threads stay
+    //  readable while it grows. The number of rows is atomic too: it is stored with release
+    //  after a growth, so a reader that gets it can use the channel pointers of these rows.
+    //  A mapped arena keeps each channel in a MappedFile instead of the heap (out of core
+    //  storage): a growth extends the file in place, without copying the rows
+    template <typename T>
+    class ChannelArena
+    {
+
+        private:
+
+            std::vector<std::atomic<T *> > channels;
+            std::vector<T *> retired;
+            uint64_t retiredBytes;
+            std::vector<MappedFile *> mapped;
+            uint32_t rowSize;
+            uint32_t rowStride;
+            std::atomic<uint32_t> numRows;
+            std::atomic<uint32_t> capacityRows;
+            bool owned;
+            bool retainOnGrow;
+
+        public:
+
+            ChannelArena(uint8_t numChannels, uint32_t rowSizeParam) :
+                channels(numChannels), retiredBytes(0), rowSize(rowSizeParam), rowStride(rowSizeParam),
+                numRows(0), capacityRows(0), owned(true), retainOnGrow(false)
+            {
+                rowStride = rowStrideFor(rowSize);
+                for (size_t c = 0; c < channels.size(); c++) {
+                    channels[c].store(NULL, std::memory_order_relaxed);
+                }
+            }
+
+            ~ChannelArena()
+            {
+                for (size_t c = 0; c < channels.size(); c++) {
+                    if (owned && mapped.empty() && channels[c] != NULL) {
+                        alignedFree(channels[c]);
+                    }
+                }
+                releaseRetired();
+                for (size_t c = 0; c < mapped.size(); c++) {
+                    delete mapped[c];
+                }
+            }
+
+            uint8_t getNumChannels() const
+            {
+                return channels.size();
+            }
+
+            uint32_t getRowSize() const
+            {
+                return rowSize;
+            }
+
+            // Row stride used for numRowSize elements of T, it is the layout of external memory too
+            static uint32_t rowStrideFor(uint32_t numRowSize)
+            {
+                uint32_t rowAlign = CHANNEL_ARENA_ALIGNMENT / sizeof(T);
+                return numRowSize > 1 ? (numRowSize + rowAlign - 1) / rowAlign * rowAlign : numRowSize;
+            }
+
+            uint32_t getRowStride() const
+            {
+                return rowStride;
+            }
+
+            uint32_t getNumRows() const
+            {
+                return numRows.load(std::memory_order_acquire);
+            }
+
+            uint32_t getCapacityRows() const
+            {
+                return capacityRows.load(std::memory_order_relaxed);
+            }
+
+            // Bytes of the storage of all the channels, owned or external, and of the retained
+            //  arenas not released yet
+            uint64_t getBytes() const
+            {
+                return (uint64_t)channels.size() * getCapacityRows() * rowStride * sizeof(T) + retiredBytes;
+            }
+
+            T *row(uint8_t channel, uint32_t numRow)
+            {
+                return channels[channel].load(std::memory_order_acquire) + (size_t)numRow * rowStride;
+            }
+
+            const T *row(uint8_t channel, uint32_t numRow) const
+            {
+                return channels[channel].load(std::memory_order_acquire) + (size_t)numRow * rowStride;
+            }
+
+            // Moves the storage of the channels to files created in directory, before the first
+            //  reserve. False if a file can not be created, the arena stays in the heap
+            bool setMapped(const std::string &directory)
+            {
+                if (getCapacityRows() > 0 || !mapped.empty()) {
+                    return false;
+                }
+                for (size_t c = 0; c < channels.size(); c++)
+                {
+                    MappedFile *file = MappedFile::create(directory);
+                    if (file == NULL) {
+                        for (size_t i = 0; i < mapped.size(); i++) {
+                            delete mapped[i];
+                        }
+                        mapped.clear();
+                        return false;
+                    }
+                    mapped.push_back(file);
+                }
+                return true;
+            }
+
+            bool isMapped() const
+            {
+                return !mapped.empty();
+            }
+
+            // Hints the kernel to read rows rows from firstRow of all the channels of a mapped
+            //  arena, nothing for a heap arena
+            void willNeed(uint32_t firstRow, uint32_t rows)
+            {
+                uint32_t usedRows = getNumRows();
+                if (firstRow >= usedRows || !owned) {
+                    return;
+                }
+                if (rows > usedRows - firstRow) {
+                    rows = usedRows - firstRow;
+                }
+                for (size_t c = 0; c < mapped.size(); c++) {
+                    mapped[c]->willNeed((size_t)firstRow * rowStride * sizeof(T), (size_t)rows * rowStride * sizeof(T));
+                }
+            }
+
+            // Keeps the arenas replaced by a growth instead of freeing them
+            void setRetainOnGrow(bool retain)
+            {
+                retainOnGrow = retain;
+            }
+
+            // Frees the retained arenas, when no other thread can read them
+            void releaseRetired()
+            {
+                for (size_t i = 0; i < retired.size(); i++) {
+                    alignedFree(retired[i]);
+                }
+                retired.clear();
+                retiredBytes = 0;
+                for (size_t c = 0; c < mapped.size(); c++) {
+                    mapped[c]->releaseRetired();
+                }
+            }
+
+            // Reallocates all the channel arenas for rows rows, the new rows are zero.
+            //  False if the memory or the disk space of the mapped files can not be allocated:
+            //  the rows and the capacity are unchanged, as the content of the rows
+            bool reserve(uint32_t rows)
+            {
+                uint32_t previousRows = getCapacityRows();
+                if (rows <= previousRows) {
+                    return true;
+                }
+                size_t bytes = (size_t)rows * rowStride * sizeof(T);
+                size_t usedBytes = (size_t)getNumRows() * rowStride * sizeof(T);
+                for (size_t c = 0; c < channels.size(); c++)
+                {
+                    T *previous = channels[c].load(std::memory_order_relaxed);
+                    if (!mapped.empty()) {
+                        // the file keeps the owned rows and its new bytes are zero
+                        T *arena = static_cast<T *>(mapped[c]->grow(bytes, retainOnGrow));
+                        if (arena == NULL) {
+                            return false;
+                        }
+                        if (previous != NULL && !owned) {
+                            memcpy(arena, previous, usedBytes);
+                            memset(reinterpret_cast<uint8_t *>(arena) + usedBytes, 0, bytes - usedBytes);
+                        }
+                        channels[c].store(arena, std::memory_order_release);
+                        continue;
+                    }
+                    T *arena = static_cast<T *>(alignedTryAlloc(bytes));
+                    if (arena == NULL) {
+                        return false;
+                    }
+                    if (previous != NULL) {
+                        memcpy(arena, previous, usedBytes);
+                    }
+                    memset(reinterpret_cast<uint8_t *>(arena) + usedBytes, 0, bytes - usedBytes);
+                    channels[c].store(arena, std::memory_order_release);
+                    if (previous != NULL && owned) {
+                        if (retainOnGrow) {
+                            retired.push_back(previous);
+                            retiredBytes += (uint64_t)previousRows * rowStride * sizeof(T);
+                        } else {
+                            alignedFree(previous);
+                        }
+                    }
+                }
+                capacityRows.store(rows, std::memory_order_relaxed);
+                owned = true;
+                return true;
+            }
+
+            // Makes the channels point to rows rows of external memory with the layout
+            //  of this arena, any owned memory is released
+            void attach(const std::vector<T *> &externalChannels, uint32_t rows)
+            {
+                for (size_t c = 0; c < channels.size(); c++) {
+                    if (owned && mapped.empty() && channels[c] != NULL) {
+                        alignedFree(channels[c]);
+                    }
+                    channels[c].store(externalChannels[c], std::memory_order_release);
+                }
+                capacityRows.store(rows, std::memory_order_relaxed);
+                numRows.store(rows, std::memory_order_release);
+                owned = false;
+            }
+
+            // Sets the number of rows, growing the arenas geometrically when needed.
+            //  False, with the rows unchanged, if the growth fails
+            bool resize(uint32_t rows)
+            {
+                uint32_t capacity = getCapacityRows();
+                if (rows > capacity) {
+                    uint32_t grow = capacity + capacity / 2;
+                    if (!reserve(rows > grow ? rows : grow) && !reserve(rows)) {
+                        return false;
+                    }
+                }
+                numRows.store(rows, std::memory_order_release);
+                return true;
+            }
+
+        private:
+
+            ChannelArena(const ChannelArena&);
+            ChannelArena& operator=(const ChannelArena&);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_CHANNELARENA_H_ */
@@ -0,0 +1,199 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API lazy analysis header
+#include "LarmorSoundAPI_Lazy.h"
+#include "LarmorSoundAPI_AubioState.h"
+
+#include <algorithm>
+
+namespace Larmor {
+
+    LazyAnalysis::LazyAnalysis(ChannelArena<smpl_t> *samplesArena, ChannelArena<int16_t> *pcmArena,
+        ChannelArena<smpl_t> *spectraArena, ChannelArena<uint8_t> *codesArena, ChannelArena<smpl_t> &energyArena,
+        ChannelArena<smpl_t> &rmsArena, ChannelArena<smpl_t> &peakArena, uint32_t numSamplesParam,
+        const AnalysisOptions &options, const vect_smpl &windowValues, spectrum_kernel kernelFunction,
+        const std::atomic<uint32_t> &playPositionRef) :
+        samples(samplesArena), pcm(pcmArena), spectra(spectraArena), codes(codesArena), energy(energyArena),
+        rms(rmsArena), peak(peakArena), numSamples(numSamplesParam), numBlocks(energyArena.getNumRows()),
+        fftSize(options.fftSize), hopSize(options.hopSize), numChannels(energyArena.getNumChannels()),
+        window(windowValues), kernel(kernelFunction), quantizer(options), states(energyArena.getNumRows()),
+        numReady(0), playPosition(playPositionRef), stopping(false)
+    {
+        for (uint32_t b = 0; b < numBlocks; b++)
+        {
+            states[b].store(LAZY_BLOCK_MISSING, std::memory_order_relaxed);
+        }
+        createWorker(caller);
+        createWorker(prefetcher);
+    }
+
+    LazyAnalysis::~LazyAnalysis()
+    {
+        stopping = true;
+        if (prefetchThread.joinable()) {
+            prefetchThread.join();
+        }
+        deleteWorker(caller);
+        deleteWorker(prefetcher);
+    }
+
+    bool LazyAnalysis::createWorker(Worker &worker)
+    {
+        uint32_t numBins = fftSize / 2 + 1;
+        worker.fft = AubioState::newFFT(fftSize);
+        worker.fftgrain = new_cvec(fftSize);
+        worker.ring = new BlockRing(1, numChannels, fftSize, numBins, codes != NULL ? quantizer.getRowBytes(numBins) : 0);
+        worker.block = worker.ring->freeBlocks.pop();
+        return worker.fft != NULL;
+    }
+
+    void LazyAnalysis::deleteWorker(Worker &worker)
+    {
+        if (worker.fft != NULL) {
+            AubioState::deleteFFT(worker.fft);
+        }
+        del_cvec(worker.fftgrain);
+        delete worker.ring;
+    }
+
+    bool LazyAnalysis::isValid()
+    {
+        return caller.fft != NULL && prefetcher.fft != NULL;
+    }
+
+    void LazyAnalysis::startPrefetch()
+    {
+        prefetchThread = std::thread(&LazyAnalysis::prefetchLoop, this);
+    }
+
+    bool LazyAnalysis::claim(uint32_t block)
+    {
+        uint8_t expected = LAZY_BLOCK_MISSING;
+        return states[block].compare_exchange_strong(expected, LAZY_BLOCK_COMPUTING);
+    }
+
+    void LazyAnalysis::ensure(uint32_t block)
+    {
+        if (states[block].load(std::memory_order_acquire) == LAZY_BLOCK_READY) {
+            return;
+        }
+        if (claim(block)) {
+            std::lock_guard<std::mutex> lock(callerMutex);
+            compute(caller, block);
+            return;
+        }
+        // The prefetch thread or another caller is computing it, at most one block of work
+        while (states[block].load(std::memory_order_acquire) != LAZY_BLOCK_READY)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void LazyAnalysis::ensureAll()
+    {
+        for (uint32_t b = 0; b < numBlocks; b++)
+        {
+            ensure(b);
+        }
+    }
+
+    uint32_t LazyAnalysis::getNumReady()
+    {
+        return numReady;
+    }
+
+    // Same frame as the loading pipeline: fftSize samples from block * hopSize, zero padded
+    void LazyAnalysis::compute(Worker &worker, uint32_t block)
+    {
+        AnalysisBlock *scratch = worker.block;
+        uint32_t frameStart = block * hopSize;
+        uint32_t frameRead = frameStart < numSamples ? std::min(fftSize, numSamples - frameStart) : 0;
+        for (uint8_t channel = 0; channel < numChannels; channel++)
+        {
+            smpl_t *frame = scratch->samples->data[channel];
+            readStoredSamples(samples, pcm, channel, frameStart, frameRead, frame);
+            std::fill(frame + frameRead, frame + fftSize, (smpl_t)0.0);
+        }
+        scratch->index = block;
+        scratch->read = frameRead;
+
+        for (uint8_t channel = 0; channel < numChannels; channel++)
+        {
+            analyzeBlockChannel(worker.fft, worker.fftgrain, window, kernel, codes != NULL ? &quantizer : NULL,
+                scratch, channel);
+            if (codes != NULL) {
+                memcpy(codes->row(channel, block), scratch->codes->row(channel, 0), codes->getRowSize());
+            } else {
+                memcpy(spectra->row(channel, block), scratch->spectra->row(channel, 0),
+                    spectra->getRowSize() * sizeof(smpl_t));
+            }
+            *energy.row(channel, block) = scratch->energy[channel];
+            *rms.row(channel, block) = scratch->rms[channel];
+            *peak.row(channel, block) = scratch->peak[channel];
+        }
+        states[block].store(LAZY_BLOCK_READY, std::memory_order_release);
+        numReady++;
+    }
+
+    void LazyAnalysis::prefetchLoop()
+    {
+        // The blocks closer than distance to center are not missing anymore: the search
+        //  restarts from the center only when the play position moves to another block
+        uint32_t center = UINT32_MAX;
+        uint32_t distance = 0;
+        while (!stopping && numReady < numBlocks)
+        {
+            uint32_t playBlock = std::min(playPosition.load() / hopSize, numBlocks - 1);
+            if (playBlock != center) {
+                center = playBlock;
+                distance = 0;
+            }
+            bool claimed = false;
+            for (; distance < numBlocks; distance++)
+            {
+                uint32_t after = center + distance;
+                if (after < numBlocks && claim(after)) {
+                    compute(prefetcher, after);
+                    claimed = true;
+                } else if (distance > 0 && distance <= center && claim(center - distance)) {
+                    compute(prefetcher, center - distance);
+                    claimed = true;
+                }
+                if (claimed) {
+                    break; // the same distance again, for the block before the center
+                }
+            }
+            if (!claimed) {
+                // Every block is claimed: the callers are computing the last ones
+                return;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,144 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_LAZY_H_
+#define LARMORSOUNDAPI_LAZY_H_
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+#include "LarmorSoundAPI_BlockRing.h"
+#include "LarmorSoundAPI_Quantizer.h"
+
+namespace Larmor {
+
+    // State of a block of the lazy analysis, it only moves forward
+    enum LazyBlockState
+    {
+        LAZY_BLOCK_MISSING = 0,
+        LAZY_BLOCK_COMPUTING = 1,
+        LAZY_BLOCK_READY = 2
+    };
+
+    // Spectra and levels computed on the first access to a block and kept in the arenas.
+    //  A background thread computes the missing blocks, nearest the play position first
+    //  (the blocks after it before the ones before it), until all of them are ready.
+    //  The blocks are claimed with a compare and swap, so each one is computed once, by the
+    //  first thread needing it; the readers wait for a block another thread is computing
+    class LazyAnalysis
+    {
+
+        private:
+
+            // FFT objects and scratch block of one computing thread
+            struct Worker
+            {
+                aubio_fft_t *fft;
+                cvec_t *fftgrain;
+                BlockRing *ring;
+                AnalysisBlock *block;
+            };
+
+            ChannelArena<smpl_t> *samples;
+            ChannelArena<int16_t> *pcm;
+            ChannelArena<smpl_t> *spectra;
+            ChannelArena<uint8_t> *codes;
+            ChannelArena<smpl_t> &energy;
+            ChannelArena<smpl_t> &rms;
+            ChannelArena<smpl_t> &peak;
+            uint32_t numSamples;
+            uint32_t numBlocks;
+            uint32_t fftSize;
+            uint32_t hopSize;
+            uint8_t numChannels;
+            vect_smpl window;
+            spectrum_kernel kernel;
+            SpectrumQuantizer quantizer;
+            std::vector<std::atomic<uint8_t> > states;
+            std::atomic<uint32_t> numReady;
+
+            // The API threads share one worker, the prefetch thread has its own
+            std::mutex callerMutex;
+            Worker caller;
+            Worker prefetcher;
+            const std::atomic<uint32_t> &playPosition;
+            std::atomic<bool> stopping;
+            std::thread prefetchThread;
+
+        public:
+
+            // The arenas have numBlocks rows, spectra is NULL with quantized storage, codes otherwise;
+            //  samples is NULL with int16 sample storage, pcm otherwise
+            LazyAnalysis(ChannelArena<smpl_t> *samplesArena, ChannelArena<int16_t> *pcmArena,
+                ChannelArena<smpl_t> *spectraArena, ChannelArena<uint8_t> *codesArena, ChannelArena<smpl_t> &energyArena,
+                ChannelArena<smpl_t> &rmsArena, ChannelArena<smpl_t> &peakArena, uint32_t numSamplesParam,
+                const AnalysisOptions &options, const vect_smpl &windowValues, spectrum_kernel kernelFunction,
+                const std::atomic<uint32_t> &playPositionRef);
+
+            // Stops the prefetch thread
+            ~LazyAnalysis();
+
+            // False if the FFT objects could not be created
+            bool isValid();
+
+            // Starts the background computation
+            void startPrefetch();
+
+            // Returns when the block is in the arenas
+            void ensure(uint32_t block);
+
+            // Computes all the missing blocks in the caller thread
+            void ensureAll();
+
+            uint32_t getNumReady();
+
+        private:
+
+            LazyAnalysis(const LazyAnalysis&);
+            LazyAnalysis& operator=(const LazyAnalysis&);
+
+            bool createWorker(Worker &worker);
+
+            void deleteWorker(Worker &worker);
+
+            // Claims a missing block, false if another thread has already claimed it
+            bool claim(uint32_t block);
+
+            void compute(Worker &worker, uint32_t block);
+
+            void prefetchLoop();
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_LAZY_H_ */
@@ -0,0 +1,185 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API mapped file header
+#include "LarmorSoundAPI_MappedFile.h"
+
+#include <cstdlib>
+#include <chrono>
+
+#if !defined(PLATFORM_WINDOWS)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace Larmor {
+
+    MappedFile::MappedFile(int fdParam) : fd(fdParam), view(NULL), viewSize(0)
+    {
+    }
+
+    MappedFile *MappedFile::create(const std::string &directory)
+    {
+#if defined(PLATFORM_WINDOWS)
+        return NULL;
+#else
+        std::string path = directory;
+        if (path.empty()) {
+            const char *tmpdir = getenv("TMPDIR");
+            path = tmpdir != NULL && tmpdir[0] != '\0' ? tmpdir : "/tmp";
+        }
+        path += "/larmorsound-XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(&name[0]);
+        if (fd < 0) {
+            return NULL;
+        }
+        unlink(&name[0]); // the open descriptor and the mappings keep the file
+        return new MappedFile(fd);
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+#if !defined(PLATFORM_WINDOWS)
+        releaseRetired();
+        if (view != NULL) {
+            munmap(view, viewSize);
+        }
+        close(fd);
+#endif
+    }
+
+    void *MappedFile::grow(size_t bytes, bool retainPrevious)
+    {
+#if defined(PLATFORM_WINDOWS)
+        return NULL;
+#else
+        if (bytes <= viewSize) {
+            return view;
+        }
+        // The blocks are allocated now: a full disk fails here instead of raising
+        //  SIGBUS at the first write of a page
+#if defined(PLATFORM_LINUX)
+        if (posix_fallocate(fd, 0, bytes) != 0) {
+            return NULL;
+        }
+#else
+        if (ftruncate(fd, bytes) != 0) {
+            return NULL;
+        }
+#endif
+        void *newView = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (newView == MAP_FAILED) {
+            return NULL;
+        }
+        if (view != NULL) {
+            if (retainPrevious) {
+                retired.push_back(std::make_pair(view, viewSize));
+            } else {
+                munmap(view, viewSize);
+            }
+        }
+        view = newView;
+        viewSize = bytes;
+        return view;
+#endif
+    }
+
+    void MappedFile::willNeed(size_t offset, size_t bytes)
+    {
+#if !defined(PLATFORM_WINDOWS)
+        if (view == NULL || offset >= viewSize) {
+            return;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t begin = offset / page * page;
+        size_t end = offset + bytes < viewSize ? offset + bytes : viewSize;
+        madvise(static_cast<uint8_t *>(view) + begin, end - begin, MADV_WILLNEED);
+#endif
+    }
+
+    void MappedFile::releaseRetired()
+    {
+#if !defined(PLATFORM_WINDOWS)
+        for (size_t i = 0; i < retired.size(); i++) {
+            munmap(retired[i].first, retired[i].second);
+        }
+        retired.clear();
+#endif
+    }
+
+    MappedReadahead::MappedReadahead(const std::atomic<uint32_t> &playPositionRef, uint32_t numSamplesParam,
+        uint32_t windowSamplesParam, const std::function<void(uint32_t, uint32_t)> &adviseFunction) :
+        playPosition(playPositionRef), numSamples(numSamplesParam), windowSamples(windowSamplesParam),
+        advise(adviseFunction), stopping(false)
+    {
+        thread = std::thread(&MappedReadahead::loop, this);
+    }
+
+    MappedReadahead::~MappedReadahead()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    void MappedReadahead::loop()
+    {
+        // [hintedBegin, hintedEnd) is the window hinted last time
+        uint32_t hintedBegin = 0;
+        uint32_t hintedEnd = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            uint32_t position = playPosition.load(std::memory_order_relaxed);
+            if (position < numSamples) {
+                uint32_t end = numSamples - position > windowSamples ? position + windowSamples : numSamples;
+                if (position < hintedBegin || position > hintedEnd) {
+                    advise(position, end - position);
+                    hintedBegin = position;
+                    hintedEnd = end;
+                } else if (end - hintedEnd >= windowSamples / 2 || (end == numSamples && end > hintedEnd)) {
+                    // moving forward: the part of the window not hinted yet, in chunks of half window
+                    advise(hintedEnd, end - hintedEnd);
+                    hintedBegin = position;
+                    hintedEnd = end;
+                }
+            }
+            wake.wait_for(lock, std::chrono::milliseconds(MAPPED_READAHEAD_PERIOD_MS));
+        }
+    }
+
+}
@@ -0,0 +1,130 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_MAPPEDFILE_H_
+#define LARMORSOUNDAPI_MAPPEDFILE_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Samples ahead of the play position whose pages are hinted to the kernel, in seconds
+#define MAPPED_READAHEAD_SECONDS 4
+// Interval between two checks of the play position by the readahead thread, in milliseconds
+#define MAPPED_READAHEAD_PERIOD_MS 50
+
+namespace Larmor {
+
+    // Unlinked temporary file mapped shared in memory: its pages are backed by the file,
+    //  so the kernel can write them back and drop them under memory pressure instead of
+    //  swapping anonymous memory. The file is deleted at creation, it is released with the
+    //  last mapping.
+    //  A growth extends the file and maps it again: the previous view shows the same pages,
+    //  so nothing is copied and, when retained, it stays readable until releaseRetired
+    class MappedFile
+    {
+
+        private:
+
+            int fd;
+            void *view;
+            size_t viewSize;
+            std::vector<std::pair<void *, size_t> > retired;
+
+            MappedFile(int fdParam);
+
+        public:
+
+            // Creates the file in directory, the system temporary directory if empty.
+            //  NULL if the file can not be created or mapped files are not supported
+            static MappedFile *create(const std::string &directory);
+
+            ~MappedFile();
+
+            // Extends the file to bytes and returns the new view of the whole file, the bytes
+            //  after the previous size are zero. The previous view is unmapped, or kept until
+            //  releaseRetired if retainPrevious. NULL if the disk space can not be allocated
+            void *grow(size_t bytes, bool retainPrevious);
+
+            // Hints the kernel to read the pages of a byte range of the view in advance
+            void willNeed(size_t offset, size_t bytes);
+
+            void releaseRetired();
+
+        private:
+
+            MappedFile(const MappedFile&);
+            MappedFile& operator=(const MappedFile&);
+
+    };
+
+    // Thread following the play position: every MAPPED_READAHEAD_PERIOD_MS it calls advise
+    //  with the samples not yet hinted in the window of windowSamples after the position,
+    //  so the pages of the mapped storage are read before the audio callback touches them.
+    //  A seek, or a move back, hints the whole window again
+    class MappedReadahead
+    {
+
+        private:
+
+            const std::atomic<uint32_t> &playPosition;
+            uint32_t numSamples;
+            uint32_t windowSamples;
+            std::function<void(uint32_t, uint32_t)> advise;
+            std::mutex mutex;
+            std::condition_variable wake;
+            bool stopping;
+            std::thread thread;
+
+        public:
+
+            // advise(firstSample, numSamples) is called in the readahead thread
+            MappedReadahead(const std::atomic<uint32_t> &playPositionRef, uint32_t numSamplesParam,
+                uint32_t windowSamplesParam, const std::function<void(uint32_t, uint32_t)> &adviseFunction);
+
+            // Stops the thread
+            ~MappedReadahead();
+
+        private:
+
+            MappedReadahead(const MappedReadahead&);
+            MappedReadahead& operator=(const MappedReadahead&);
+
+            void loop();
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_MAPPEDFILE_H_ */
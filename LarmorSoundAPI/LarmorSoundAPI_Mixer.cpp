@@ -0,0 +1,207 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API mixer header
+#include "LarmorSoundAPI_Mixer.h"
+#include "LarmorSoundAPI_ChannelArena.h"
+
+#include <algorithm>
+
+namespace Larmor {
+
+    AudioMixer::AudioMixer() : device(0), numSlots(0), numVoices(0), voiceBuffer(NULL), upmixBuffer(NULL),
+        kernels(getMixKernels())
+    {
+        memset(&spec, 0, sizeof(spec));
+        for (uint32_t s = 0; s < MIXER_MAX_VOICES; s++)
+        {
+            voices[s] = NULL;
+        }
+    }
+
+    AudioMixer *AudioMixer::open(uint32_t samplerate, uint8_t channels, uint16_t bufferFrames)
+    {
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+            std::cout << "LarmorSound:: Error: SDL_Init error!" << std::endl;
+            return NULL;
+        }
+
+        AudioMixer *mixer = new AudioMixer();
+        SDL_AudioSpec want, have;
+        SDL_memset(&want, 0, sizeof(want));
+        want.freq = samplerate;
+        want.format = AUDIO_F32;
+        want.channels = channels;
+        want.samples = bufferFrames;
+        want.callback = AudioMixer::forwardSDLCallback;
+        want.userdata = mixer;
+
+        // SDL converts to the device format, only the buffer size can change
+        mixer->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+        if (mixer->device == 0) {
+            std::cout << "LarmorSound:: Error: couldn't open audio: " << SDL_GetError() << std::endl;
+            delete mixer;
+            return NULL;
+        }
+        mixer->spec.freq = have.freq;
+        mixer->spec.format = have.format;
+        mixer->spec.channels = have.channels;
+        mixer->spec.samples = have.samples;
+        mixer->spec.size = have.size;
+        mixer->spec.bufferSeconds = have.samples * 1.0 / have.freq;
+        mixer->spec.latencySeconds = mixer->spec.bufferSeconds * PLAYBACK_LATENCY_BUFFERS;
+        size_t bufferBytes = (size_t)have.samples * have.channels * sizeof(float);
+        mixer->voiceBuffer = static_cast<float *>(alignedAlloc(bufferBytes));
+        mixer->upmixBuffer = static_cast<float *>(alignedAlloc(bufferBytes));
+
+        std::cout << "LarmorSound:: mixer audio device: " << have.freq << "Hz, " << (int)have.channels
+            << " channels, buffer " << have.samples << " frames, " << mixer->kernels.name
+            << " mix kernels" << std::endl;
+        SDL_PauseAudioDevice(mixer->device, 0); // the voices play silence when stopped
+        return mixer;
+    }
+
+    AudioMixer::~AudioMixer()
+    {
+        if (device != 0) {
+            SDL_CloseAudioDevice(device);
+        }
+        if (voiceBuffer != NULL) {
+            alignedFree(voiceBuffer);
+        }
+        if (upmixBuffer != NULL) {
+            alignedFree(upmixBuffer);
+        }
+    }
+
+    MixerStatus AudioMixer::addVoice(LarmorSound *voice)
+    {
+        if (voice->samplerate != (uint32_t)spec.freq
+            || (voice->numChannels != spec.channels && voice->numChannels != 1)) {
+            std::cout << "LarmorSound:: error: a " << voice->samplerate << "Hz track with " << (int)voice->numChannels
+                << " channels can not play on the " << spec.freq << "Hz mixer with " << (int)spec.channels
+                << " channels!" << std::endl;
+            return MIXER_ERROR_FORMAT;
+        }
+        for (uint32_t s = 0; s < MIXER_MAX_VOICES; s++)
+        {
+            LarmorSound *empty = NULL;
+            if (voices[s].compare_exchange_strong(empty, voice)) {
+                if (numSlots < s + 1) {
+                    numSlots = s + 1;
+                }
+                numVoices++;
+                return MIXER_OK;
+            }
+        }
+        std::cout << "LarmorSound:: error: the mixer is already playing " << MIXER_MAX_VOICES << " voices!" << std::endl;
+        return MIXER_ERROR_FULL;
+    }
+
+    void AudioMixer::removeVoice(LarmorSound *voice)
+    {
+        for (uint32_t s = 0; s < numSlots; s++)
+        {
+            if (voices[s] == voice) {
+                // The callback runs with the device locked: once locked it is not rendering the voice
+                SDL_LockAudioDevice(device);
+                voices[s] = NULL;
+                SDL_UnlockAudioDevice(device);
+                numVoices--;
+                return;
+            }
+        }
+    }
+
+    void AudioMixer::waitCallback()
+    {
+        SDL_LockAudioDevice(device);
+        SDL_UnlockAudioDevice(device);
+    }
+
+    uint32_t AudioMixer::getNumVoices()
+    {
+        return numVoices;
+    }
+
+    const PlaybackSpec &AudioMixer::getSpec()
+    {
+        return spec;
+    }
+
+    void AudioMixer::forwardSDLCallback(void *userdata, Uint8 *stream, int len)
+    {
+        AudioMixer *mixer = static_cast<AudioMixer *>(userdata);
+        int64_t callbackTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        float *out = reinterpret_cast<float *>(stream);
+        uint32_t frames = len / (sizeof(float) * mixer->spec.channels);
+        // SDL asks for spec.samples frames, larger requests are mixed in parts
+        while (frames > 0)
+        {
+            uint32_t part = std::min(frames, (uint32_t)mixer->spec.samples);
+            mixer->mix(out, part, callbackTimeNs);
+            out += (size_t)part * mixer->spec.channels;
+            frames -= part;
+        }
+    }
+
+    // Audio thread: sums the voices with their gain in out
+    void AudioMixer::mix(float *out, uint32_t frames, int64_t callbackTimeNs)
+    {
+        uint8_t channels = spec.channels;
+        memset(out, 0, (size_t)frames * channels * sizeof(float));
+        uint32_t slots = numSlots;
+        for (uint32_t s = 0; s < slots; s++)
+        {
+            LarmorSound *voice = voices[s];
+            if (voice == NULL) {
+                continue;
+            }
+            uint32_t written = voice->renderPlayback(voiceBuffer, frames, callbackTimeNs);
+            if (written == 0) {
+                continue;
+            }
+            float gain = voice->playbackGain;
+            if (voice->numChannels == channels) {
+                kernels.gainSum(voiceBuffer, gain, out, written * channels);
+            } else {
+                // mono voice on all the channels
+                for (uint32_t i = 0; i < written; i++)
+                {
+                    for (uint8_t c = 0; c < channels; c++)
+                    {
+                        upmixBuffer[i * channels + c] = voiceBuffer[i];
+                    }
+                }
+                kernels.gainSum(upmixBuffer, gain, out, written * channels);
+            }
+        }
+    }
+
+}
@@ -0,0 +1,96 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_MIXER_H_
+#define LARMORSOUNDAPI_MIXER_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "LarmorSoundAPI.h"
+#include "LarmorSoundAPI_SIMD.h"
+
+namespace Larmor {
+
+    // Software mixer of any number of LarmorSound voices on one SDL audio device.
+    //  The device callback renders each voice in a preallocated buffer and sums it with the
+    //  voice gain (SIMD mix kernels): it never allocates and never takes a lock.
+    //  The voices are atomic slots: a voice is added with a compare and swap and removed
+    //  under SDL_LockAudioDevice, so the callback is never using a removed voice
+    class AudioMixer
+    {
+
+        private:
+
+            SDL_AudioDeviceID device;
+            PlaybackSpec spec;
+            std::atomic<LarmorSound *> voices[MIXER_MAX_VOICES];
+            std::atomic<uint32_t> numSlots;     // slots used so far, the callback scans only these
+            uint32_t numVoices;
+            float *voiceBuffer;                 // one voice rendered, in the voice layout
+            float *upmixBuffer;                 // mono voice copied to all the device channels
+            const MixKernels &kernels;
+
+            AudioMixer();
+
+        public:
+
+            // Opens the audio device, NULL on error
+            static AudioMixer *open(uint32_t samplerate, uint8_t channels, uint16_t bufferFrames);
+
+            // Closes the audio device
+            ~AudioMixer();
+
+            // The voice must have the samplerate of the device, and its channels or one channel,
+            //  else MIXER_ERROR_FORMAT
+            MixerStatus addVoice(LarmorSound *voice);
+
+            // Returns when the audio callback can not use the voice anymore
+            void removeVoice(LarmorSound *voice);
+
+            // Returns when the audio callback running at the call, if any, is over
+            void waitCallback();
+
+            uint32_t getNumVoices();
+
+            const PlaybackSpec &getSpec();
+
+        private:
+
+            AudioMixer(const AudioMixer&);
+            AudioMixer& operator=(const AudioMixer&);
+
+            static void forwardSDLCallback(void *userdata, Uint8 *stream, int len);
+
+            void mix(float *out, uint32_t frames, int64_t callbackTimeNs);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_MIXER_H_ */
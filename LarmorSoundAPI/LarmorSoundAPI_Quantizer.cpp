@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API spectrum quantizer header
+#include "LarmorSoundAPI_Quantizer.h"
+#include "LarmorSoundAPI_SIMD.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace Larmor {
+
+    SpectrumQuantizer::SpectrumQuantizer(const AnalysisOptions &options) : mode(options.spectrumMode),
+        scale(options.spectrumScale), rangeDb(options.spectrumRangeDb)
+    {
+        codeBytes = (options.spectrumStorage == SPECTRUM_STORAGE_LOG8) ? 1 : 2;
+        maxCode = (codeBytes == 1) ? 0xFF : 0xFFFF;
+        // The samples are in [-1, 1] and the window is at most 1, so the FFT norm is at most
+        //  fftSize and the phase at most pi: the stored power is at most fftSize^2 + pi^2
+        double fftSize = options.fftSize;
+        fullScaleDb = 10.0 * log10(fftSize * fftSize + M_PI * M_PI);
+    }
+
+    uint32_t SpectrumQuantizer::getRowBytes(uint32_t numBins) const
+    {
+        return SPECTRUM_CODES_HEADER_BYTES + numBins * codeBytes;
+    }
+
+    uint32_t SpectrumQuantizer::getCodeBytes() const
+    {
+        return codeBytes;
+    }
+
+    smpl_t SpectrumQuantizer::getGlobalErrorDb() const
+    {
+        return rangeDb / (maxCode - 1) / 2;
+    }
+
+    void SpectrumQuantizer::quantize(smpl_t *values, uint32_t numBins, uint8_t *row) const
+    {
+        // Levels in dB of the power, -HUGE_VALF for the zero values
+        smpl_t maxDb = -HUGE_VALF;
+        smpl_t minDb = HUGE_VALF;
+        for (uint32_t j = 0; j < numBins; j++)
+        {
+            smpl_t db = values[j];
+            if (mode == SPECTRUM_MAGNITUDE) {
+                db = values[j] > 0 ? 20.0f * log10f(values[j]) : -HUGE_VALF;
+            } else if (mode == SPECTRUM_POWER) {
+                db = values[j] > 0 ? 10.0f * log10f(values[j]) : -HUGE_VALF;
+            }
+            values[j] = db;
+            maxDb = std::max(maxDb, db);
+            if (db > -HUGE_VALF) {
+                minDb = std::min(minDb, db);
+            }
+        }
+
+        smpl_t floorDb = fullScaleDb - rangeDb;
+        smpl_t topDb = fullScaleDb;
+        if (scale == SPECTRUM_SCALE_BLOCK) {
+            if (maxDb == -HUGE_VALF) {
+                floorDb = topDb = 0.0; // silent row, all codes are 0
+            } else {
+                topDb = maxDb;
+                floorDb = std::max(minDb, maxDb - rangeDb);
+            }
+        }
+        smpl_t stepDb = topDb > floorDb ? (topDb - floorDb) / (maxCode - 1) : 0.0f;
+        memcpy(row, &floorDb, sizeof(smpl_t));
+        memcpy(row + sizeof(smpl_t), &stepDb, sizeof(smpl_t));
+
+        uint8_t *codes8 = row + SPECTRUM_CODES_HEADER_BYTES;
+        uint16_t *codes16 = reinterpret_cast<uint16_t *>(codes8);
+        for (uint32_t j = 0; j < numBins; j++)
+        {
+            uint32_t code = 0;
+            if (values[j] >= floorDb && values[j] > -HUGE_VALF) {
+                code = stepDb > 0 ? 1 + (uint32_t)((values[j] - floorDb) / stepDb + 0.5f) : 1;
+                code = std::min(code, maxCode);
+            }
+            if (codeBytes == 1) {
+                codes8[j] = code;
+            } else {
+                codes16[j] = code;
+            }
+        }
+    }
+
+    void SpectrumQuantizer::dequantize(const uint8_t *row, uint32_t numBins, smpl_t *values) const
+    {
+        smpl_t floorDb = rowFloorDb(row);
+        smpl_t stepDb = rowStepDb(row);
+        smpl_t silence = (mode == SPECTRUM_DB) ? 10.0f * log10f(SPECTRUM_DB_POWER_FLOOR) : 0.0f;
+        // 10^(dB / 20) = e^(dB * ln(10) / 20)
+        smpl_t expFactor = (mode == SPECTRUM_MAGNITUDE) ? M_LN10 / 20.0 : M_LN10 / 10.0;
+
+        const uint8_t *codes8 = row + SPECTRUM_CODES_HEADER_BYTES;
+        const uint16_t *codes16 = reinterpret_cast<const uint16_t *>(codes8);
+        for (uint32_t j = 0; j < numBins; j++)
+        {
+            uint32_t code = (codeBytes == 1) ? codes8[j] : codes16[j];
+            if (code == 0) {
+                values[j] = silence;
+                continue;
+            }
+            smpl_t db = floorDb + (code - 1) * stepDb;
+            values[j] = (mode == SPECTRUM_DB) ? db : expf(db * expFactor);
+        }
+    }
+
+    smpl_t SpectrumQuantizer::rowFloorDb(const uint8_t *row)
+    {
+        smpl_t floorDb;
+        memcpy(&floorDb, row, sizeof(smpl_t));
+        return floorDb;
+    }
+
+    smpl_t SpectrumQuantizer::rowStepDb(const uint8_t *row)
+    {
+        smpl_t stepDb;
+        memcpy(&stepDb, row + sizeof(smpl_t), sizeof(smpl_t));
+        return stepDb;
+    }
+
+}
@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_QUANTIZER_H_
+#define LARMORSOUNDAPI_QUANTIZER_H_
+
+#include <cstdint>
+
+#include "LarmorSoundAPI.h"
+
+// Bytes before the codes in a quantized spectrum row: the floor and the step in dB as floats
+#define SPECTRUM_CODES_HEADER_BYTES 8
+
+namespace Larmor {
+
+    // Quantizes the spectrum rows to 8 or 16 bit log magnitude codes, as selected by
+    //  AnalysisOptions::spectrumStorage. A quantized row is:
+    //    float floorDb, float stepDb, then one code per bin
+    //  code 0 is a value below floorDb (silence), decoded as 0 (as -200 dB in SPECTRUM_DB mode),
+    //  code c > 0 is the level floorDb + (c - 1) * stepDb in dB of the power,
+    //  so magnitude = 10^(dB / 20), power = 10^(dB / 10).
+    //  The global scale covers spectrumRangeDb below the full scale of the FFT, the block
+    //  scale covers the levels of the row, at most spectrumRangeDb below its maximum.
+    //  The decoded level of a value in range is within stepDb / 2 of the exact one
+    class SpectrumQuantizer
+    {
+
+        private:
+
+            SpectrumMode mode;
+            SpectrumScale scale;
+            uint32_t codeBytes;     // 1 or 2
+            uint32_t maxCode;       // 255 or 65535
+            smpl_t fullScaleDb;     // level of the largest possible value
+            smpl_t rangeDb;
+
+        public:
+
+            SpectrumQuantizer(const AnalysisOptions &options);
+
+            // Bytes of a quantized row of numBins values
+            uint32_t getRowBytes(uint32_t numBins) const;
+
+            uint32_t getCodeBytes() const;
+
+            // Worst case error of a decoded level in range, in dB: stepDb / 2 of the global scale
+            smpl_t getGlobalErrorDb() const;
+
+            // Writes the quantized row of values in row, values are overwritten with their level in dB
+            void quantize(smpl_t *values, uint32_t numBins, uint8_t *row) const;
+
+            // Decodes a quantized row in values
+            void dequantize(const uint8_t *row, uint32_t numBins, smpl_t *values) const;
+
+            // Floor and step in dB of a quantized row
+            static smpl_t rowFloorDb(const uint8_t *row);
+
+            static smpl_t rowStepDb(const uint8_t *row);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_QUANTIZER_H_ */
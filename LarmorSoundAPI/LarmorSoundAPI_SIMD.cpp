@@ -0,0 +1,405 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API SIMD kernels header
+#include "LarmorSoundAPI_SIMD.h"
+
+#include <cmath>
+
+// x86 kernels are compiled with target attributes, so the library does not need
+// -mavx2 and still runs on CPUs without it
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define LARMOR_SIMD_X86 1
+    #include <immintrin.h>
+#else
+    #define LARMOR_SIMD_X86 0
+#endif
+
+namespace Larmor {
+
+    static void magnitudeScalar(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        for (uint32_t j = 0; j < length; j++)
+        {
+            out[j] = std::sqrt(norm[j] * norm[j] + phas[j] * phas[j]);
+        }
+    }
+
+    static void powerScalar(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        for (uint32_t j = 0; j < length; j++)
+        {
+            out[j] = norm[j] * norm[j] + phas[j] * phas[j];
+        }
+    }
+
+    // The logarithm has no SIMD instruction: the decibel kernels compute the power
+    //  with their instruction set, then convert it with this loop
+    static void powerToDecibel(float *out, uint32_t length)
+    {
+        for (uint32_t j = 0; j < length; j++)
+        {
+            out[j] = 10.0f * std::log10(out[j] > SPECTRUM_DB_POWER_FLOOR ? out[j] : SPECTRUM_DB_POWER_FLOOR);
+        }
+    }
+
+    static void decibelScalar(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        powerScalar(norm, phas, out, length);
+        powerToDecibel(out, length);
+    }
+
+    static void gainScalar(const float *in, float gain, float *out, uint32_t length)
+    {
+        for (uint32_t i = 0; i < length; i++)
+        {
+            out[i] = gain * in[i];
+        }
+    }
+
+    static void gainSumScalar(const float *in, float gain, float *out, uint32_t length)
+    {
+        for (uint32_t i = 0; i < length; i++)
+        {
+            out[i] += gain * in[i];
+        }
+    }
+
+    static void encodePcmScalar(const float *in, int16_t *out, uint32_t length)
+    {
+        for (uint32_t i = 0; i < length; i++)
+        {
+            float value = in[i] * PCM_INT16_SCALE;
+            // written as the SIMD max and min, which give the low bound for NaN
+            value = value > -32768.0f ? value : -32768.0f;
+            value = value < 32767.0f ? value : 32767.0f;
+            out[i] = (int16_t)std::nearbyint(value);
+        }
+    }
+
+    static void decodePcmScalar(const int16_t *in, float *out, uint32_t length)
+    {
+        for (uint32_t i = 0; i < length; i++)
+        {
+            out[i] = in[i] * (1.0f / PCM_INT16_SCALE);
+        }
+    }
+
+#if LARMOR_SIMD_X86
+
+    __attribute__((target("sse2")))
+    static void magnitudeSSE2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        uint32_t j = 0;
+        for (; j + 4 <= length; j += 4)
+        {
+            __m128 n = _mm_loadu_ps(norm + j);
+            __m128 p = _mm_loadu_ps(phas + j);
+            __m128 sum = _mm_add_ps(_mm_mul_ps(n, n), _mm_mul_ps(p, p));
+            _mm_storeu_ps(out + j, _mm_sqrt_ps(sum));
+        }
+        magnitudeScalar(norm + j, phas + j, out + j, length - j);
+    }
+
+    __attribute__((target("sse2")))
+    static void powerSSE2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        uint32_t j = 0;
+        for (; j + 4 <= length; j += 4)
+        {
+            __m128 n = _mm_loadu_ps(norm + j);
+            __m128 p = _mm_loadu_ps(phas + j);
+            _mm_storeu_ps(out + j, _mm_add_ps(_mm_mul_ps(n, n), _mm_mul_ps(p, p)));
+        }
+        powerScalar(norm + j, phas + j, out + j, length - j);
+    }
+
+    static void decibelSSE2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        powerSSE2(norm, phas, out, length);
+        powerToDecibel(out, length);
+    }
+
+    // No FMA: a fused multiply-add would round differently from the scalar kernels.
+    //  The AVX2 kernels clear the upper halves of the ymm registers before their SSE2 tail,
+    //  and so before returning: the compiler does not always emit it before a tail call,
+    //  and the dirty state makes every following SSE instruction (the tails, the log10 of
+    //  the decibel kernel, the SDL and libc code after the mix) pay a transition penalty
+    __attribute__((target("avx2")))
+    static void magnitudeAVX2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        uint32_t j = 0;
+        for (; j + 8 <= length; j += 8)
+        {
+            __m256 n = _mm256_loadu_ps(norm + j);
+            __m256 p = _mm256_loadu_ps(phas + j);
+            __m256 sum = _mm256_add_ps(_mm256_mul_ps(n, n), _mm256_mul_ps(p, p));
+            _mm256_storeu_ps(out + j, _mm256_sqrt_ps(sum));
+        }
+        _mm256_zeroupper();
+        magnitudeSSE2(norm + j, phas + j, out + j, length - j);
+    }
+
+    __attribute__((target("avx2")))
+    static void powerAVX2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        uint32_t j = 0;
+        for (; j + 8 <= length; j += 8)
+        {
+            __m256 n = _mm256_loadu_ps(norm + j);
+            __m256 p = _mm256_loadu_ps(phas + j);
+            _mm256_storeu_ps(out + j, _mm256_add_ps(_mm256_mul_ps(n, n), _mm256_mul_ps(p, p)));
+        }
+        _mm256_zeroupper();
+        powerSSE2(norm + j, phas + j, out + j, length - j);
+    }
+
+    static void decibelAVX2(const float *norm, const float *phas, float *out, uint32_t length)
+    {
+        powerAVX2(norm, phas, out, length);
+        powerToDecibel(out, length);
+    }
+
+    __attribute__((target("sse2")))
+    static void gainSSE2(const float *in, float gain, float *out, uint32_t length)
+    {
+        __m128 g = _mm_set1_ps(gain);
+        uint32_t i = 0;
+        for (; i + 4 <= length; i += 4)
+        {
+            _mm_storeu_ps(out + i, _mm_mul_ps(g, _mm_loadu_ps(in + i)));
+        }
+        gainScalar(in + i, gain, out + i, length - i);
+    }
+
+    __attribute__((target("sse2")))
+    static void gainSumSSE2(const float *in, float gain, float *out, uint32_t length)
+    {
+        __m128 g = _mm_set1_ps(gain);
+        uint32_t i = 0;
+        for (; i + 4 <= length; i += 4)
+        {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(g, _mm_loadu_ps(in + i)));
+            _mm_storeu_ps(out + i, sum);
+        }
+        gainSumScalar(in + i, gain, out + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void gainAVX2(const float *in, float gain, float *out, uint32_t length)
+    {
+        __m256 g = _mm256_set1_ps(gain);
+        uint32_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(g, _mm256_loadu_ps(in + i)));
+        }
+        _mm256_zeroupper();
+        gainSSE2(in + i, gain, out + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void gainSumAVX2(const float *in, float gain, float *out, uint32_t length)
+    {
+        __m256 g = _mm256_set1_ps(gain);
+        uint32_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m256 sum = _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(g, _mm256_loadu_ps(in + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+        _mm256_zeroupper();
+        gainSumSSE2(in + i, gain, out + i, length - i);
+    }
+
+    // The conversion rounds to the nearest even as nearbyint in the default rounding mode
+    __attribute__((target("sse2")))
+    static void encodePcmSSE2(const float *in, int16_t *out, uint32_t length)
+    {
+        __m128 scale = _mm_set1_ps(PCM_INT16_SCALE);
+        __m128 low = _mm_set1_ps(-32768.0f);
+        __m128 high = _mm_set1_ps(32767.0f);
+        uint32_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), low), high);
+            __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), low), high);
+            __m128i codes = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), codes);
+        }
+        encodePcmScalar(in + i, out + i, length - i);
+    }
+
+    __attribute__((target("sse2")))
+    static void decodePcmSSE2(const int16_t *in, float *out, uint32_t length)
+    {
+        __m128 scale = _mm_set1_ps(1.0f / PCM_INT16_SCALE);
+        uint32_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            // sign extension: the code in the high half, shifted back
+            __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(codes, codes), 16);
+            __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(codes, codes), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+        }
+        decodePcmScalar(in + i, out + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void encodePcmAVX2(const float *in, int16_t *out, uint32_t length)
+    {
+        __m256 scale = _mm256_set1_ps(PCM_INT16_SCALE);
+        __m256 low = _mm256_set1_ps(-32768.0f);
+        __m256 high = _mm256_set1_ps(32767.0f);
+        uint32_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), low), high);
+            __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), low), high);
+            // the pack works per 128 bit lane, the permute puts the codes back in order
+            __m256i codes = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+            codes = _mm256_permute4x64_epi64(codes, 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), codes);
+        }
+        _mm256_zeroupper();
+        encodePcmSSE2(in + i, out + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void decodePcmAVX2(const int16_t *in, float *out, uint32_t length)
+    {
+        __m256 scale = _mm256_set1_ps(1.0f / PCM_INT16_SCALE);
+        uint32_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(codes)), scale));
+        }
+        _mm256_zeroupper();
+        decodePcmSSE2(in + i, out + i, length - i);
+    }
+
+    static const SpectrumKernels sse2Kernels = { "sse2", magnitudeSSE2, powerSSE2, decibelSSE2 };
+    static const SpectrumKernels avx2Kernels = { "avx2", magnitudeAVX2, powerAVX2, decibelAVX2 };
+    static const MixKernels sse2MixKernels = { "sse2", gainSSE2, gainSumSSE2 };
+    static const MixKernels avx2MixKernels = { "avx2", gainAVX2, gainSumAVX2 };
+    static const PcmKernels sse2PcmKernels = { "sse2", encodePcmSSE2, decodePcmSSE2 };
+    static const PcmKernels avx2PcmKernels = { "avx2", encodePcmAVX2, decodePcmAVX2 };
+
+#endif
+
+    static const SpectrumKernels scalarKernels = { "scalar", magnitudeScalar, powerScalar, decibelScalar };
+    static const MixKernels scalarMixKernels = { "scalar", gainScalar, gainSumScalar };
+    static const PcmKernels scalarPcmKernels = { "scalar", encodePcmScalar, decodePcmScalar };
+
+    const SpectrumKernels &getScalarSpectrumKernels()
+    {
+        return scalarKernels;
+    }
+
+    const SpectrumKernels *getSSE2SpectrumKernels()
+    {
+#if LARMOR_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            return &sse2Kernels;
+        }
+#endif
+        return NULL;
+    }
+
+    const SpectrumKernels *getAVX2SpectrumKernels()
+    {
+#if LARMOR_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return &avx2Kernels;
+        }
+#endif
+        return NULL;
+    }
+
+    static const SpectrumKernels &selectSpectrumKernels()
+    {
+        const SpectrumKernels *kernels = getAVX2SpectrumKernels();
+        if (kernels == NULL) {
+            kernels = getSSE2SpectrumKernels();
+        }
+        return kernels != NULL ? *kernels : scalarKernels;
+    }
+
+    const SpectrumKernels &getSpectrumKernels()
+    {
+        // initialized once, thread safe since C++11
+        static const SpectrumKernels &kernels = selectSpectrumKernels();
+        return kernels;
+    }
+
+    // Same instruction set of the spectrum kernels
+    static const MixKernels &selectMixKernels()
+    {
+#if LARMOR_SIMD_X86
+        if (getAVX2SpectrumKernels() != NULL) {
+            return avx2MixKernels;
+        }
+        if (getSSE2SpectrumKernels() != NULL) {
+            return sse2MixKernels;
+        }
+#endif
+        return scalarMixKernels;
+    }
+
+    const MixKernels &getMixKernels()
+    {
+        static const MixKernels &kernels = selectMixKernels();
+        return kernels;
+    }
+
+    // Same instruction set of the spectrum kernels
+    static const PcmKernels &selectPcmKernels()
+    {
+#if LARMOR_SIMD_X86
+        if (getAVX2SpectrumKernels() != NULL) {
+            return avx2PcmKernels;
+        }
+        if (getSSE2SpectrumKernels() != NULL) {
+            return sse2PcmKernels;
+        }
+#endif
+        return scalarPcmKernels;
+    }
+
+    const PcmKernels &getPcmKernels()
+    {
+        static const PcmKernels &kernels = selectPcmKernels();
+        return kernels;
+    }
+
+}
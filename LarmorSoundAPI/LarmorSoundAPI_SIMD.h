@@ -0,0 +1,101 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_SIMD_H_
+#define LARMORSOUNDAPI_SIMD_H_
+
+#include <cstdint>
+
+// Floor of the power in SpectrumKernels::decibel, -200 dB
+#define SPECTRUM_DB_POWER_FLOOR 1e-20f
+// Full scale of the int16 sample storage: a sample s is stored as the code s * PCM_INT16_SCALE
+#define PCM_INT16_SCALE 32768.0f
+
+namespace Larmor {
+
+    // Kernels computing a spectrum value per bin from the aubio FFT norm and phase arrays:
+    //  magnitude: out[j] = sqrt(norm[j]^2 + phas[j]^2), as the original spectrum computation
+    //  power:     out[j] = norm[j]^2 + phas[j]^2
+    //  decibel:   out[j] = 10 * log10(max(power, SPECTRUM_DB_POWER_FLOOR))
+    //  The SIMD versions give the same results as the scalar ones, bit by bit
+    typedef void (*spectrum_kernel)(const float *norm, const float *phas, float *out, uint32_t length);
+
+    struct SpectrumKernels
+    {
+        const char *name;
+        spectrum_kernel magnitude;
+        spectrum_kernel power;
+        spectrum_kernel decibel;
+    };
+
+    // Best kernels for the running CPU (AVX2, SSE2 or scalar), selected at the first call
+    const SpectrumKernels &getSpectrumKernels();
+
+    // Kernels of each instruction set, for the benchmark: the SSE2 and AVX2 ones
+    //  are NULL when not compiled in or not supported by the running CPU
+    const SpectrumKernels &getScalarSpectrumKernels();
+
+    const SpectrumKernels *getSSE2SpectrumKernels();
+
+    const SpectrumKernels *getAVX2SpectrumKernels();
+
+    // Kernels of the playback mixer on interleaved samples, in and out can be the same buffer:
+    //  gain:    out[i] = gain * in[i]
+    //  gainSum: out[i] += gain * in[i]
+    typedef void (*mix_kernel)(const float *in, float gain, float *out, uint32_t length);
+
+    struct MixKernels
+    {
+        const char *name;
+        mix_kernel gain;
+        mix_kernel gainSum;
+    };
+
+    // Best mix kernels for the running CPU, selected at the first call
+    const MixKernels &getMixKernels();
+
+    // Kernels of the int16 sample storage:
+    //  encode: out[i] = in[i] * PCM_INT16_SCALE rounded to the nearest, clamped to [-32768, 32767]
+    //  decode: out[i] = in[i] / PCM_INT16_SCALE
+    //  Decoding an encoded 16 bit source sample gives the same float, bit by bit
+    typedef void (*pcm_encode_kernel)(const float *in, int16_t *out, uint32_t length);
+    typedef void (*pcm_decode_kernel)(const int16_t *in, float *out, uint32_t length);
+
+    struct PcmKernels
+    {
+        const char *name;
+        pcm_encode_kernel encode;
+        pcm_decode_kernel decode;
+    };
+
+    // Best int16 kernels for the running CPU, selected at the first call
+    const PcmKernels &getPcmKernels();
+
+}
+
+#endif /* LARMORSOUNDAPI_SIMD_H_ */
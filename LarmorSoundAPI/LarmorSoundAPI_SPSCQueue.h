@@ -0,0 +1,109 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_SPSCQUEUE_H_
+#define LARMORSOUNDAPI_SPSCQUEUE_H_
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Distance in bytes between the producer and the consumer indexes, so they do not share a cache line
+#define SPSC_QUEUE_CACHE_LINE 64
+
+namespace Larmor {
+
+    // Wait-free bounded FIFO for one producer thread and one consumer thread:
+    //  push and pop never block and never allocate, so the consumer can be a real-time
+    //  audio callback. More producer threads must serialize push with a lock of their own
+    template <typename T>
+    class SPSCQueue
+    {
+
+        private:
+
+            std::vector<T> items;
+            uint32_t mask;
+            char paddingHead[SPSC_QUEUE_CACHE_LINE];
+            std::atomic<uint32_t> head; // next item to pop, written by the consumer
+            char paddingTail[SPSC_QUEUE_CACHE_LINE];
+            std::atomic<uint32_t> tail; // next item to push, written by the producer
+
+        public:
+
+            // capacity is rounded up to a power of 2
+            SPSCQueue(uint32_t capacity) : head(0), tail(0)
+            {
+                uint32_t size = 1;
+                while (size < capacity) {
+                    size *= 2;
+                }
+                items.resize(size);
+                mask = size - 1;
+            }
+
+            // Producer: false if the queue is full
+            bool push(const T &item)
+            {
+                uint32_t currentTail = tail.load(std::memory_order_relaxed);
+                if (currentTail - head.load(std::memory_order_acquire) > mask) {
+                    return false;
+                }
+                items[currentTail & mask] = item;
+                tail.store(currentTail + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Consumer: false if the queue is empty
+            bool pop(T &item)
+            {
+                uint32_t currentHead = head.load(std::memory_order_relaxed);
+                if (currentHead == tail.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                item = items[currentHead & mask];
+                head.store(currentHead + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Consumer: drops all the queued items
+            void clear()
+            {
+                head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+            }
+
+        private:
+
+            SPSCQueue(const SPSCQueue&);
+            SPSCQueue& operator=(const SPSCQueue&);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_SPSCQUEUE_H_ */
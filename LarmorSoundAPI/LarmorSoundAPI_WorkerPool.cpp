@@ -0,0 +1,218 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// LarmorSound API worker pool header
+#include "LarmorSoundAPI_WorkerPool.h"
+
+namespace Larmor {
+
+    WorkerPool::WorkerPool(uint32_t numThreads) : pendingTasks(0), stopping(false)
+    {
+        if (numThreads == 0) {
+            numThreads = defaultNumThreads();
+        }
+        for (uint32_t i = 0; i < numThreads; i++) {
+            workers.push_back(std::thread(&WorkerPool::workerLoop, this, i));
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    uint32_t WorkerPool::getNumThreads()
+    {
+        return workers.size();
+    }
+
+    void WorkerPool::submit(const worker_task &task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+            pendingTasks++;
+        }
+        taskAvailable.notify_one();
+    }
+
+    void WorkerPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (pendingTasks > 0) {
+            tasksDone.wait(lock);
+        }
+    }
+
+    uint32_t WorkerPool::defaultNumThreads()
+    {
+        uint32_t cores = std::thread::hardware_concurrency();
+        return cores > 0 ? cores : 1;
+    }
+
+    void WorkerPool::workerLoop(uint32_t workerIndex)
+    {
+        while (true)
+        {
+            worker_task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping && tasks.empty()) {
+                    taskAvailable.wait(lock);
+                }
+                if (tasks.empty()) {
+                    return; // stopping
+                }
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            task(workerIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingTasks--;
+                if (pendingTasks == 0) {
+                    tasksDone.notify_all();
+                }
+            }
+        }
+    }
+
+    WorkStealingPool::WorkStealingPool(uint32_t numThreads) : queuedTasks(0), pendingTasks(0), nextQueue(0),
+        stopping(false)
+    {
+        if (numThreads == 0) {
+            numThreads = WorkerPool::defaultNumThreads();
+        }
+        for (uint32_t i = 0; i < numThreads; i++) {
+            queues.push_back(new WorkerQueue());
+        }
+        for (uint32_t i = 0; i < numThreads; i++) {
+            workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+        }
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        for (size_t i = 0; i < queues.size(); i++) {
+            delete queues[i];
+        }
+    }
+
+    uint32_t WorkStealingPool::getNumThreads()
+    {
+        return workers.size();
+    }
+
+    void WorkStealingPool::submit(const worker_task &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        WorkerQueue *queue = queues[nextQueue];
+        nextQueue = (nextQueue + 1) % queues.size();
+        {
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            queue->tasks.push_back(task);
+        }
+        queuedTasks++;
+        pendingTasks++;
+        taskAvailable.notify_all();
+    }
+
+    void WorkStealingPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (pendingTasks > 0) {
+            tasksDone.wait(lock);
+        }
+    }
+
+    bool WorkStealingPool::takeTask(uint32_t workerIndex, worker_task &task)
+    {
+        for (size_t i = 0; i < queues.size(); i++)
+        {
+            // its own queue first, then the next ones
+            WorkerQueue *queue = queues[(workerIndex + i) % queues.size()];
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            if (!queue->tasks.empty()) {
+                // a thief takes the oldest task too: the largest one of a batch submitted largest first
+                task = queue->tasks.front();
+                queue->tasks.pop_front();
+                queuedTasks--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkStealingPool::workerLoop(uint32_t workerIndex)
+    {
+        while (true)
+        {
+            worker_task task;
+            if (!takeTask(workerIndex, task)) {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping && queuedTasks == 0) {
+                    taskAvailable.wait(lock);
+                }
+                if (stopping && queuedTasks == 0) {
+                    return;
+                }
+                continue;
+            }
+
+            task(workerIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingTasks--;
+                if (pendingTasks == 0) {
+                    tasksDone.notify_all();
+                }
+            }
+        }
+    }
+
+}
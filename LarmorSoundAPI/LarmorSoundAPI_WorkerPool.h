@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+#ifndef LARMORSOUNDAPI_WORKERPOOL_H_
+#define LARMORSOUNDAPI_WORKERPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include <atomic>
+
+namespace Larmor {
+
+    // Task executed by a worker: receives the index of the worker running it
+    // (0 .. numThreads-1), so the caller can keep per worker resources
+    // (i.e. one aubio FFT object per thread)
+    typedef std::function<void(uint32_t)> worker_task;
+
+    class WorkerPool
+    {
+
+        private:
+
+            std::vector<std::thread> workers;
+            std::deque<worker_task> tasks;
+            std::mutex mutex;
+            std::condition_variable taskAvailable;
+            std::condition_variable tasksDone;
+            uint32_t pendingTasks;
+            bool stopping;
+
+        public:
+
+            // Constructor
+            //  Starts numThreads workers, 0 means one worker per hardware core
+            WorkerPool(uint32_t numThreads = 0);
+
+            // Destructor
+            //  Waits the queued tasks and joins the workers
+            ~WorkerPool();
+
+            uint32_t getNumThreads();
+
+            void submit(const worker_task &task);
+
+            // Blocks until all the submitted tasks have been executed
+            void wait();
+
+            // Number of threads used when 0 is passed to the constructor
+            static uint32_t defaultNumThreads();
+
+        private:
+
+            WorkerPool(const WorkerPool&);
+            WorkerPool& operator=(const WorkerPool&);
+
+            void workerLoop(uint32_t workerIndex);
+
+    };
+
+    // Pool whose workers have one task queue each: the tasks are queued to the workers in
+    //  turn, a worker runs its own tasks in order and, when its queue is empty, steals from
+    //  the front of the queue of another worker. The tasks submitted longest first (as
+    //  loadBatch does) are then run longest first by all the workers, so the short ones
+    //  fill the end. Tasks of very different length (the loading of files of different
+    //  duration) keep all the workers busy, without one queue contended by all of them
+    class WorkStealingPool
+    {
+
+        private:
+
+            struct WorkerQueue
+            {
+                std::mutex mutex;
+                std::deque<worker_task> tasks;
+            };
+
+            std::vector<std::thread> workers;
+            std::vector<WorkerQueue *> queues;
+            std::mutex mutex;
+            std::condition_variable taskAvailable;
+            std::condition_variable tasksDone;
+            std::atomic<uint32_t> queuedTasks; // in the queues, not taken yet
+            uint32_t pendingTasks;  // under mutex, submitted and not finished
+            uint32_t nextQueue;     // under mutex
+            bool stopping;          // under mutex
+
+        public:
+
+            // Constructor
+            //  Starts numThreads workers, 0 means one worker per hardware core
+            WorkStealingPool(uint32_t numThreads = 0);
+
+            // Destructor
+            //  Waits the queued tasks and joins the workers
+            ~WorkStealingPool();
+
+            uint32_t getNumThreads();
+
+            void submit(const worker_task &task);
+
+            // Blocks until all the submitted tasks have been executed
+            void wait();
+
+        private:
+
+            WorkStealingPool(const WorkStealingPool&);
+            WorkStealingPool& operator=(const WorkStealingPool&);
+
+            // Next task of the worker: the front of its queue, else the front of another one
+            bool takeTask(uint32_t workerIndex, worker_task &task);
+
+            void workerLoop(uint32_t workerIndex);
+
+    };
+
+}
+
+#endif /* LARMORSOUNDAPI_WORKERPOOL_H_ */
@@ -0,0 +1,486 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// Headless batch analysis: loads media files on all the cores with LarmorSound::loadBatch
+//  and writes, per file, the spectrum and the level curves (energy, RMS, peak) of every
+//  frame of every channel, as binary or CSV, plus a CSV of the per stage timings.
+//  The files are processed in groups of groupFiles, so the memory is bounded by the group.
+//  Usage: LarmorSoundAPI_batch [options] input...
+//    input: a media file, a directory (its files, not recursive) or @list (one path per line)
+//    -o dir            output directory, default .
+//    -f bin|csv        output format, default bin
+//    -j threads        loading and writing threads, default 0 (one per hardware core)
+//    -g groupFiles     files loaded together, default 4 per thread
+//    --fft N --hop N   STFT frame and hop sizes, default 1024 1024
+//    --window rect|hann|hamming|blackman
+//    --mode magnitude|power|db
+//    --no-spectrum     writes only the level curves
+//  Binary spectrum file (name.spectrum.bin), in the byte order of the machine:
+//    char magic[8] "LSSPEC01", uint32 numChannels, samplerate, numFrames, numBins, fftSize,
+//    hopSize, sourceOffset, then float32 [numChannels][numFrames][numBins]
+//  Binary levels file (name.levels.bin):
+//    char magic[8] "LSLEVL01", uint32 numChannels, samplerate, numFrames, fftSize, hopSize,
+//    sourceOffset, then float32 [numChannels][3][numFrames]: energy, RMS, peak
+//  The frame k of a channel starts at the sample sourceOffset + k * hopSize of the file
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(PLATFORM_WINDOWS)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <dirent.h>
+#endif
+
+#include "LarmorSoundAPI/LarmorSoundAPI_Client.h"
+
+using namespace Larmor;
+
+typedef std::chrono::steady_clock batch_clock;
+
+struct BatchOptions
+{
+    std::string outputDirectory;
+    bool csv;
+    bool writeSpectrum;
+    uint32_t numThreads;
+    uint32_t groupFiles;
+    AnalysisOptions analysis;
+};
+
+// Outcome of a file, a row of the timings CSV
+struct FileReport
+{
+    std::string input;
+    std::string outputName;
+    LoadStatus status;
+    uint32_t numChannels;
+    uint32_t samplerate;
+    uint32_t numSamples;
+    uint32_t numFrames;
+    LoadTimings timings;
+    double writeSeconds;
+    uint64_t bytesWritten;
+    bool written;           // all the outputs written
+};
+
+static double elapsedSeconds(batch_clock::time_point start)
+{
+    return std::chrono::duration<double>(batch_clock::now() - start).count();
+}
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Appends the inputs of an argument: the files of a directory are sorted by name
+static bool addInput(const std::string &input, std::vector<std::string> &files)
+{
+    if (!input.empty() && input[0] == '@') {
+        std::ifstream list(input.substr(1).c_str());
+        if (!list) {
+            std::cout << "Error: could not read the list " << input.substr(1) << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (!line.empty() && line[0] != '#') {
+                files.push_back(line);
+            }
+        }
+        return true;
+    }
+#if !defined(PLATFORM_WINDOWS)
+    struct stat info;
+    if (stat(input.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(input.c_str());
+        if (dir == NULL) {
+            std::cout << "Error: could not read the directory " << input << std::endl;
+            return false;
+        }
+        std::vector<std::string> entries;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string path = input + "/" + entry->d_name;
+            if (entry->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                entries.push_back(path);
+            }
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        files.insert(files.end(), entries.begin(), entries.end());
+        return true;
+    }
+#endif
+    files.push_back(input);
+    return true;
+}
+
+static bool writeHeader(FILE *file, const char *magic, const std::vector<uint32_t> &fields)
+{
+    return fwrite(magic, 1, 8, file) == 8
+        && fwrite(&fields[0], sizeof(uint32_t), fields.size(), file) == fields.size();
+}
+
+static bool writeSpectrumFile(LarmorSound &sound, const BatchOptions &options, const std::string &path,
+    FileReport &report)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t hop = options.analysis.hopSize;
+    uint32_t numBins = options.analysis.fftSize / 2 + 1;
+    bool written = options.csv
+        ? fprintf(file, "channel,frame,time") >= 0
+        : writeHeader(file, "LSSPEC01", { report.numChannels, report.samplerate, report.numFrames, numBins,
+            options.analysis.fftSize, hop, sound.getSourceOffset() });
+    for (uint32_t bin = 0; options.csv && written && bin < numBins; bin++)
+    {
+        written = fprintf(file, ",bin%u", bin) >= 0;
+    }
+    written = written && (!options.csv || fprintf(file, "\n") >= 0);
+    vect_smpl spectrum;
+    for (uint8_t c = 0; c < report.numChannels && written; c++)
+    {
+        for (uint32_t frame = 0; frame < report.numFrames && written; frame++)
+        {
+            written = sound.getChannelSpectrum(c, frame * hop, spectrum) && spectrum.size() == numBins;
+            if (!written) {
+                break;
+            }
+            if (!options.csv) {
+                written = fwrite(&spectrum[0], sizeof(float), numBins, file) == numBins;
+                continue;
+            }
+            double time = (sound.getSourceOffset() + frame * (double)hop) / report.samplerate;
+            written = fprintf(file, "%u,%u,%.9g", (uint32_t)c, frame, time) >= 0;
+            for (uint32_t bin = 0; bin < numBins && written; bin++)
+            {
+                written = fprintf(file, ",%.9g", spectrum[bin]) >= 0;
+            }
+            written = written && fprintf(file, "\n") >= 0;
+        }
+    }
+    long bytes = ftell(file);
+    written = (fclose(file) == 0) && written;
+    report.bytesWritten += bytes > 0 ? bytes : 0;
+    return written;
+}
+
+static bool writeLevelsFile(LarmorSound &sound, const BatchOptions &options, const std::string &path,
+    FileReport &report)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t hop = options.analysis.hopSize;
+    bool written;
+    if (options.csv) {
+        written = fprintf(file, "frame,time") >= 0;
+        for (uint32_t c = 0; c < report.numChannels && written; c++)
+        {
+            written = fprintf(file, ",energy%u,rms%u,peak%u", c, c, c) >= 0;
+        }
+        written = written && fprintf(file, "\n") >= 0;
+        for (uint32_t frame = 0; frame < report.numFrames && written; frame++)
+        {
+            double time = (sound.getSourceOffset() + frame * (double)hop) / report.samplerate;
+            written = fprintf(file, "%u,%.9g", frame, time) >= 0;
+            for (uint8_t c = 0; c < report.numChannels && written; c++)
+            {
+                written = fprintf(file, ",%.9g,%.9g,%.9g", sound.getChannelEnergy(c, frame * hop),
+                    sound.getChannelRMS(c, frame * hop), sound.getChannelPeak(c, frame * hop)) >= 0;
+            }
+            written = written && fprintf(file, "\n") >= 0;
+        }
+    } else {
+        written = writeHeader(file, "LSLEVL01", { report.numChannels, report.samplerate, report.numFrames,
+            options.analysis.fftSize, hop, sound.getSourceOffset() });
+        std::vector<float> curve(report.numFrames);
+        for (uint8_t c = 0; c < report.numChannels && written; c++)
+        {
+            for (uint32_t level = 0; level < 3 && written; level++)
+            {
+                for (uint32_t frame = 0; frame < report.numFrames; frame++)
+                {
+                    uint32_t position = frame * hop;
+                    curve[frame] = level == 0 ? sound.getChannelEnergy(c, position)
+                        : level == 1 ? sound.getChannelRMS(c, position) : sound.getChannelPeak(c, position);
+                }
+                written = curve.empty() || fwrite(&curve[0], sizeof(float), curve.size(), file) == curve.size();
+            }
+        }
+    }
+    long bytes = ftell(file);
+    written = (fclose(file) == 0) && written;
+    report.bytesWritten += bytes > 0 ? bytes : 0;
+    return written;
+}
+
+static void writeOutputs(LarmorSound *sound, const BatchOptions &options, FileReport &report)
+{
+    report.status = sound->getLoadStatus();
+    if (report.status != LOAD_OK) {
+        return;
+    }
+    report.numChannels = sound->getNumChannels();
+    report.samplerate = sound->getSamplerate();
+    report.numSamples = sound->getNumSamples();
+    // The frames starting in the samples, the ones the getters of a position can reach
+    uint32_t hop = options.analysis.hopSize;
+    report.numFrames = std::min(sound->getNumAnalyzedFrames(), (report.numSamples + hop - 1) / hop);
+    report.timings = sound->getLoadTimings();
+
+    batch_clock::time_point start = batch_clock::now();
+    std::string prefix = options.outputDirectory + "/" + report.outputName;
+    const char *extension = options.csv ? ".csv" : ".bin";
+    bool written = writeLevelsFile(*sound, options, prefix + ".levels" + extension, report);
+    if (written && options.writeSpectrum) {
+        written = writeSpectrumFile(*sound, options, prefix + ".spectrum" + extension, report);
+    }
+    report.written = written;
+    if (!written) {
+        std::cout << "Error: could not write the outputs of " << report.input << " in " << prefix << std::endl;
+    }
+    report.writeSeconds = elapsedSeconds(start);
+}
+
+static const char *statusName(LoadStatus status)
+{
+    switch (status)
+    {
+        case LOAD_OK: return "ok";
+        case LOAD_CANCELLED: return "cancelled";
+        case LOAD_ERROR_DEPRECATED: return "deprecated";
+        case LOAD_ERROR_OPTIONS: return "invalid options";
+        case LOAD_ERROR_OPEN: return "open error";
+        case LOAD_ERROR_ANALYSIS: return "analysis error";
+        default: return "pending";
+    }
+}
+
+static bool writeTimings(const std::string &path, const std::vector<FileReport> &reports)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fprintf(file, "input,output,status,channels,samplerate,samples,frames,"
+        "decode_s,analysis_s,store_s,load_s,analysis_threads,write_s,bytes_written\n") >= 0;
+    for (size_t i = 0; i < reports.size() && written; i++)
+    {
+        const FileReport &r = reports[i];
+        written = fprintf(file, "\"%s\",%s,%s,%u,%u,%u,%u,%.6f,%.6f,%.6f,%.6f,%u,%.6f,%llu\n",
+            r.input.c_str(), r.outputName.c_str(), statusName(r.status), r.numChannels, r.samplerate,
+            r.numSamples, r.numFrames, r.timings.decodeSeconds, r.timings.analysisSeconds,
+            r.timings.storeSeconds, r.timings.totalSeconds, r.timings.analysisThreads, r.writeSeconds,
+            (unsigned long long)r.bytesWritten) >= 0;
+    }
+    return (fclose(file) == 0) && written;
+}
+
+static bool parseChoice(const char *value, const char *const *names, int count, int &choice)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(value, names[i]) == 0) {
+            choice = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [-o dir] [-f bin|csv] [-j threads] [-g groupFiles]"
+        << " [--fft N] [--hop N] [--window rect|hann|hamming|blackman] [--mode magnitude|power|db]"
+        << " [--no-spectrum] input..." << std::endl
+        << "  input: a media file, a directory of media files or @list (one path per line)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    static const char *const formats[] = { "bin", "csv" };
+    static const char *const windows[] = { "rect", "hann", "hamming", "blackman" };
+    static const char *const modes[] = { "magnitude", "power", "db" };
+
+    BatchOptions options;
+    options.outputDirectory = ".";
+    options.csv = false;
+    options.writeSpectrum = true;
+    options.numThreads = 0;
+    options.groupFiles = 0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        int choice = 0;
+        if (arg == "-o" && hasValue) {
+            options.outputDirectory = argv[++i];
+        } else if (arg == "-f" && hasValue && parseChoice(argv[i + 1], formats, 2, choice)) {
+            options.csv = (choice == 1);
+            i++;
+        } else if (arg == "-j" && hasValue) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (arg == "-g" && hasValue) {
+            options.groupFiles = atoi(argv[++i]);
+        } else if (arg == "--fft" && hasValue) {
+            options.analysis.fftSize = atoi(argv[++i]);
+        } else if (arg == "--hop" && hasValue) {
+            options.analysis.hopSize = atoi(argv[++i]);
+        } else if (arg == "--window" && hasValue && parseChoice(argv[i + 1], windows, 4, choice)) {
+            options.analysis.window = (WindowType)choice;
+            i++;
+        } else if (arg == "--mode" && hasValue && parseChoice(argv[i + 1], modes, 3, choice)) {
+            options.analysis.spectrumMode = (SpectrumMode)choice;
+            i++;
+        } else if (arg == "--no-spectrum") {
+            options.writeSpectrum = false;
+        } else if (!arg.empty() && arg[0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else if (!addInput(arg, files)) {
+            return 1;
+        }
+    }
+    if (files.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    uint32_t numThreads = options.numThreads > 0 ? options.numThreads : std::thread::hardware_concurrency();
+    numThreads = std::max(numThreads, 1u);
+    if (options.groupFiles == 0) {
+        options.groupFiles = numThreads * 4;
+    }
+
+    // Output names: the file name, with the input index when two inputs have the same one
+    std::vector<FileReport> reports(files.size());
+    std::map<std::string, uint32_t> names;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        FileReport &report = reports[i];
+        memset(&report.timings, 0, sizeof(report.timings));
+        report.input = files[i];
+        report.outputName = baseName(files[i]);
+        if (names[report.outputName]++ > 0) {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "_%u", (uint32_t)i);
+            report.outputName += suffix;
+        }
+        report.status = LOAD_PENDING;
+        report.numChannels = report.samplerate = report.numSamples = report.numFrames = 0;
+        report.writeSeconds = 0.0;
+        report.bytesWritten = 0;
+        report.written = false;
+    }
+
+    batch_clock::time_point start = batch_clock::now();
+    double loadSeconds = 0.0;
+    double writeSeconds = 0.0;
+    for (size_t first = 0; first < files.size(); first += options.groupFiles)
+    {
+        size_t last = std::min(files.size(), first + options.groupFiles);
+        std::vector<std::string> group(files.begin() + first, files.begin() + last);
+
+        batch_clock::time_point loadStart = batch_clock::now();
+        std::vector<LarmorSound *> sounds = LarmorSound::loadBatch(group, options.analysis, numThreads);
+        loadSeconds += elapsedSeconds(loadStart);
+
+        // The outputs are written in parallel too, each file by one thread
+        batch_clock::time_point writeStart = batch_clock::now();
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> writers;
+        for (uint32_t t = 0; t < std::min<size_t>(numThreads, sounds.size()); t++)
+        {
+            writers.push_back(std::thread([&]() {
+                for (size_t i = next++; i < sounds.size(); i = next++)
+                {
+                    writeOutputs(sounds[i], options, reports[first + i]);
+                    delete sounds[i];
+                    sounds[i] = NULL;
+                }
+            }));
+        }
+        for (size_t t = 0; t < writers.size(); t++)
+        {
+            writers[t].join();
+        }
+        writeSeconds += elapsedSeconds(writeStart);
+    }
+    double totalSeconds = elapsedSeconds(start);
+
+    uint32_t loaded = 0;
+    uint32_t written = 0;
+    double audioSeconds = 0.0;
+    uint64_t bytesWritten = 0;
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        if (reports[i].status == LOAD_OK) {
+            loaded++;
+            written += reports[i].written ? 1 : 0;
+            audioSeconds += reports[i].numSamples * 1.0 / reports[i].samplerate;
+        } else {
+            std::cout << "Failed: " << reports[i].input << " (" << statusName(reports[i].status) << ")" << std::endl;
+        }
+        bytesWritten += reports[i].bytesWritten;
+    }
+    std::string timingsPath = options.outputDirectory + "/timings.csv";
+    bool timingsWritten = writeTimings(timingsPath, reports);
+    if (!timingsWritten) {
+        std::cout << "Error: could not write " << timingsPath << std::endl;
+    }
+
+    std::cout << "Batch analysis: " << loaded << " of " << files.size() << " files (" << written << " written), "
+        << audioSeconds << "s of audio on " << numThreads << " threads in " << totalSeconds
+        << "s (load " << loadSeconds << "s, write " << writeSeconds << "s)" << std::endl;
+    std::cout << "  throughput: " << (totalSeconds > 0 ? audioSeconds / totalSeconds : 0.0)
+        << "x realtime, " << (totalSeconds > 0 ? loaded / totalSeconds : 0.0) << " files/s, "
+        << bytesWritten / 1048576.0 << " MB written" << std::endl;
+    return (written == files.size() && timingsWritten) ? 0 : 2;
+}
@@ -0,0 +1,144 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// Jitter benchmark of the playback clock: plays a file on the SDL dummy audio driver, which
+//  consumes the buffers at the nominal rate, and compares getPlayPosition and
+//  getPlaybackClockPosition with the ideal clock (elapsed time * samplerate).
+//  The constant offset (start up and latency) is removed, the spread left is the jitter.
+//  Usage: LarmorSoundAPI_bench_clock file [bufferFrames] [seconds]
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+
+#include "LarmorSoundAPI/LarmorSoundAPI_Client.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct ClockStats
+{
+    double meanSamples;
+    double stddevSamples;
+    double maxSamples;
+    uint32_t backwardSteps;
+};
+
+// Error of the positions against the ideal clock, after removing the mean offset
+static ClockStats clockStats(const std::vector<double> &times, const std::vector<uint32_t> &positions, double samplerate)
+{
+    ClockStats stats = { 0.0, 0.0, 0.0, 0 };
+    if (positions.empty()) {
+        return stats;
+    }
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        stats.meanSamples += positions[i] - times[i] * samplerate;
+        if (i > 0 && positions[i] < positions[i - 1]) {
+            stats.backwardSteps++;
+        }
+    }
+    stats.meanSamples /= positions.size();
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        double error = positions[i] - times[i] * samplerate - stats.meanSamples;
+        stats.stddevSamples += error * error;
+        stats.maxSamples = std::max(stats.maxSamples, std::fabs(error));
+    }
+    stats.stddevSamples = std::sqrt(stats.stddevSamples / positions.size());
+    return stats;
+}
+
+static void printStats(const char *name, const ClockStats &stats, double samplerate)
+{
+    std::cout << "  " << name << ": jitter stddev " << stats.stddevSamples / samplerate * 1e6
+        << "us, max " << stats.maxSamples / samplerate * 1e6
+        << "us (" << stats.maxSamples << " samples), backward steps " << stats.backwardSteps << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " file [bufferFrames] [seconds]" << std::endl;
+        return 1;
+    }
+    uint16_t bufferFrames = argc > 2 ? atoi(argv[2]) : 256;
+    double seconds = argc > 3 ? atof(argv[3]) : 3.0;
+
+    // The dummy driver paces the callbacks without an audio device
+    setenv("SDL_AUDIODRIVER", "dummy", 1);
+
+    Larmor::LarmorSound sound(argv[1]);
+    if (sound.getNumSamples() == 0 || !sound.initPlay(Larmor::PLAYBACK_DIRECT, bufferFrames)) {
+        return 1;
+    }
+    Larmor::PlaybackSpec spec = sound.getPlaybackSpec();
+    seconds = std::min(seconds, sound.getNumSamples() * 1.0 / spec.freq - spec.latencySeconds * 2);
+
+    // Skip the first callbacks, while the driver starts
+    sound.play(0);
+    std::this_thread::sleep_for(std::chrono::duration<double>(spec.latencySeconds * 2));
+
+    std::vector<double> times;
+    std::vector<uint32_t> playPositions;
+    std::vector<uint32_t> clockPositions;
+    bench_clock::time_point start = bench_clock::now();
+    double elapsed = 0.0;
+    while (elapsed < seconds && sound.isPlaying())
+    {
+        bench_clock::time_point now = bench_clock::now();
+        elapsed = std::chrono::duration<double>(now - start).count();
+        times.push_back(elapsed);
+        playPositions.push_back(sound.getPlayPosition());
+        clockPositions.push_back(sound.getPlaybackClockPosition());
+        std::this_thread::sleep_for(std::chrono::microseconds(500)); // about a render loop polling
+    }
+
+    // Cost of a clock query
+    const uint32_t queries = 1000000;
+    bench_clock::time_point queryStart = bench_clock::now();
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < queries; i++)
+    {
+        sum += sound.getPlaybackClockPosition();
+    }
+    double queryNs = std::chrono::duration<double, std::nano>(bench_clock::now() - queryStart).count() / queries;
+
+    sound.stop();
+    sound.closePlay();
+
+    std::cout << "Playback clock benchmark: " << spec.freq << "Hz, buffer " << spec.samples
+        << " frames, estimated latency " << spec.latencySeconds * 1000.0 << "ms, "
+        << times.size() << " samples in " << elapsed << "s" << std::endl;
+    printStats("getPlayPosition", clockStats(times, playPositions, spec.freq), spec.freq);
+    printStats("getPlaybackClockPosition", clockStats(times, clockPositions, spec.freq), spec.freq);
+    std::cout << "  getPlaybackClockPosition query: " << queryNs << " ns (checksum " << sum % 10 << ")" << std::endl;
+    return 0;
+}
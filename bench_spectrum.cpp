@@ -0,0 +1,177 @@
+/*****************************************************************************
+ * LarmorSoundAPI 1.0 2016
+ * Copyright (c) 2016 Pier Paolo Ciarravano - http://www.larmor.com
+ * All rights reserved.
+ *
+ * This file is part of LarmorSoundAPI.
+ *
+ * LarmorSoundAPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LarmorSoundAPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LarmorSoundAPI. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ *
+ * Author: Pier Paolo Ciarravano
+ *
+ ****************************************************************************/
+
+// Micro benchmark of the spectrum kernels used by the LarmorSound analysis:
+//  compares the original per bin push_back loop with the scalar, SSE2 and AVX2
+//  kernels, checks that they give the same values and prints ns per frame.
+//  Fails if a kernel differs from the scalar one, or is slower than it by more than
+//  SIMD_SLOWDOWN_TOLERANCE (a missing vzeroupper makes the AVX2 kernels many times slower).
+//  Usage: LarmorSoundAPI_bench_spectrum [fftSize] [frames]
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "LarmorSoundAPI/LarmorSoundAPI_ChannelArena.h"
+#include "LarmorSoundAPI/LarmorSoundAPI_SIMD.h"
+
+using namespace Larmor;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// A SIMD kernel slower than the scalar one by more than this factor fails the benchmark:
+//  the margin absorbs the timing noise of the decibel mode, dominated by the same log10
+#define SIMD_SLOWDOWN_TOLERANCE 1.2
+
+// Spectrum computation as it was done inside the analysis loop
+static void legacyMagnitude(const float *norm, const float *phas, std::vector<float> &out, uint32_t length)
+{
+    out.clear();
+    out.reserve(length);
+    for (uint32_t j = 0; j < length; j++)
+    {
+        float val = sqrt(norm[j]*norm[j] + phas[j]*phas[j]);
+        out.push_back(val);
+    }
+}
+
+static double benchLegacy(const std::vector<float> &norm, const std::vector<float> &phas,
+    uint32_t bins, uint32_t frames, std::vector<float> &out)
+{
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t f = 0; f < frames; f++)
+    {
+        legacyMagnitude(&norm[f * bins], &phas[f * bins], out, bins);
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / frames;
+}
+
+static double benchKernel(spectrum_kernel kernel, const std::vector<float> &norm, const std::vector<float> &phas,
+    uint32_t bins, uint32_t frames, float *out)
+{
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t f = 0; f < frames; f++)
+    {
+        kernel(&norm[f * bins], &phas[f * bins], out, bins);
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / frames;
+}
+
+// Returns true if the kernel gives the same values of the reference kernel on the first frame
+static bool sameResults(spectrum_kernel kernel, spectrum_kernel reference, const std::vector<float> &norm,
+    const std::vector<float> &phas, uint32_t bins, float *out, float *expected)
+{
+    kernel(&norm[0], &phas[0], out, bins);
+    reference(&norm[0], &phas[0], expected, bins);
+    return memcmp(out, expected, bins * sizeof(float)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t fftSize = argc > 1 ? atoi(argv[1]) : 1024;
+    uint32_t frames = argc > 2 ? atoi(argv[2]) : 20000;
+    if (fftSize < 2 || frames == 0) {
+        std::cout << "Usage: " << argv[0] << " [fftSize] [frames]" << std::endl;
+        return 1;
+    }
+    uint32_t bins = fftSize / 2 + 1;
+
+    // Random norm and phase values, frames are distinct to avoid a cache hot single frame
+    std::vector<float> norm(bins * frames);
+    std::vector<float> phas(bins * frames);
+    srand(1234);
+    for (size_t i = 0; i < norm.size(); i++)
+    {
+        norm[i] = (float)rand() / RAND_MAX * 100.0f;
+        phas[i] = (float)rand() / RAND_MAX * 6.28f - 3.14f;
+    }
+
+    float *out = (float*)alignedAlloc(ChannelArena<float>::rowStrideFor(bins) * sizeof(float));
+    float *expected = (float*)alignedAlloc(ChannelArena<float>::rowStrideFor(bins) * sizeof(float));
+
+    std::cout << "Spectrum kernels benchmark: fftSize " << fftSize << " (" << bins << " bins), "
+        << frames << " frames, selected kernels: " << getSpectrumKernels().name << std::endl;
+
+    // Original loop against the scalar magnitude kernel
+    std::vector<float> legacy;
+    double legacyNs = benchLegacy(norm, phas, bins, frames, legacy);
+    legacyMagnitude(&norm[0], &phas[0], legacy, bins);
+    getScalarSpectrumKernels().magnitude(&norm[0], &phas[0], out, bins);
+    bool legacySame = memcmp(&legacy[0], out, bins * sizeof(float)) == 0;
+    std::cout << "  legacy push_back magnitude: " << legacyNs << " ns/frame" << std::endl;
+
+    const SpectrumKernels *kernelSets[3] = {
+        &getScalarSpectrumKernels(), getSSE2SpectrumKernels(), getAVX2SpectrumKernels()
+    };
+    const char *modeNames[3] = { "magnitude", "power", "decibel" };
+    bool allSame = legacySame;
+    bool allFaster = true;
+    double scalarNs[3] = { 0.0, 0.0, 0.0 };
+    for (int k = 0; k < 3; k++)
+    {
+        const SpectrumKernels *kernels = kernelSets[k];
+        if (kernels == NULL) {
+            continue;
+        }
+        spectrum_kernel modeKernels[3] = { kernels->magnitude, kernels->power, kernels->decibel };
+        spectrum_kernel referenceKernels[3] = { getScalarSpectrumKernels().magnitude,
+            getScalarSpectrumKernels().power, getScalarSpectrumKernels().decibel };
+        for (int m = 0; m < 3; m++)
+        {
+            double ns = benchKernel(modeKernels[m], norm, phas, bins, frames, out);
+            bool same = sameResults(modeKernels[m], referenceKernels[m], norm, phas, bins, out, expected);
+            allSame = allSame && same;
+            if (k == 0) {
+                scalarNs[m] = ns;
+            }
+            bool faster = (k == 0 || ns <= scalarNs[m] * SIMD_SLOWDOWN_TOLERANCE);
+            allFaster = allFaster && faster;
+            std::cout << "  " << kernels->name << " " << modeNames[m] << ": " << ns << " ns/frame";
+            if (m == 0) {
+                std::cout << ", speedup " << legacyNs / ns << "x";
+            }
+            std::cout << (same ? "" : " (MISMATCH)") << (faster ? "" : " (SLOWER THAN SCALAR)") << std::endl;
+        }
+    }
+
+    alignedFree(out);
+    alignedFree(expected);
+
+    if (!allSame) {
+        std::cout << "Spectrum kernels results differ from the scalar computation" << std::endl;
+        return 1;
+    }
+    if (!allFaster) {
+        std::cout << "Spectrum kernels slower than the scalar computation" << std::endl;
+        return 1;
+    }
+    return 0;
+}
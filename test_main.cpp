@@ -440,10 +440,10 @@ namespace LarmorSoundViewer {
     
         for (uint8_t c = 0; c < testObj->getNumChannels(); c++) { //channel
 
-            Larmor::vect_smpl *spectrum = testObj->getChannelSpectrum(c, testObj->getPlayPosition());
-            if (spectrum != NULL) {
-                for (uint32_t j = 0; j < (*spectrum).size(); j++) { //block
-                    float val = (*spectrum)[j];
+            Larmor::SmplView spectrum = testObj->getChannelSpectrum(c, testObj->getPlayPosition());
+            if (!spectrum.empty()) {
+                for (uint32_t j = 0; j < spectrum.size(); j++) { //block
+                    float val = spectrum[j];
                     //if (val > 5.0)
                         drawBar(c * 3.0, j*1.0-80, 0.4, val);
                     //else